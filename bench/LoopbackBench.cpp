@@ -0,0 +1,362 @@
+// End-to-end loopback benchmark. One process runs a daemon-mode Server and
+// receives from it with receive_direct(), so every byte goes through the
+// real sender Session, the receive loop, the handshake and the crypto,
+// over 127.0.0.1. The rendezvous is an in-process stub that keeps
+// registrations in memory.
+//
+// usage: zapshare_bench [--sizes 1K,1M,1G] [--runs N] [--port P]
+//                       [--dir DIR] [--netem SPEC] [--json PATH|-]
+//                       [--verbose]
+//
+// For each size it reports the median completion time (handshake to
+// verified file), throughput, and CPU seconds per GB. CPU time is the
+// whole process's, so it covers both ends of the transfer.
+//
+// --netem routes the receiver through a Netsim::Relay impairing both
+// directions, e.g. --netem delay=50ms,loss=2% for a 100 ms round trip
+// with 2% loss each way.
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <asio.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench_util.hpp"
+#include "client.hpp"
+#include "crypto.hpp"
+#include "keys.hpp"
+#include "netsim.hpp"
+#include "server.hpp"
+#include "trace.hpp"
+#include "types.h"
+#include "utils.hpp"
+
+namespace {
+
+constexpr short DEFAULT_PORT = 5273;
+constexpr int DEFAULT_RUNS = 3;
+// Up to 1 GiB by default; pass --sizes ...,10G for the long run
+constexpr char DEFAULT_SIZES[] = "1K,64K,1M,16M,256M,1G";
+
+struct Options {
+    std::vector<uint64_t> sizes;
+    int runs = DEFAULT_RUNS;
+    short port = DEFAULT_PORT;
+    // Scratch space; a directory of our own unless --dir names one
+    std::filesystem::path dir;
+    bool own_dir = true;
+    std::string json_path;
+    // Impairments for both directions; empty goes straight to the sender
+    std::string netem;
+    bool verbose = false;
+};
+
+// A thread that is stopped and joined when it goes out of scope, so an
+// exception on the way cannot leave it joinable
+struct ThreadGuard {
+    std::thread thread;
+    std::function<void()> stop;
+
+    ~ThreadGuard() {
+        if (!thread.joinable()) return;
+        if (stop) stop();
+        thread.join();
+    }
+};
+
+struct Result {
+    uint64_t size = 0;
+    std::vector<double> seconds;
+    double cpu_seconds = 0;
+    int failures = 0;
+};
+
+std::vector<uint64_t> parse_sizes(const std::string& list) {
+    std::vector<uint64_t> sizes;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        sizes.push_back(Bench::parse_size(item));
+    }
+    return sizes;
+}
+
+Options parse_options(int argc, char* argv[]) {
+    Options options;
+    options.sizes = parse_sizes(DEFAULT_SIZES);
+    options.dir = std::filesystem::temp_directory_path() /
+                  ("zapshare_bench_" + std::to_string(::getpid()));
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--sizes" && has_value) {
+            options.sizes = parse_sizes(argv[++i]);
+        } else if (arg == "--runs" && has_value) {
+            options.runs = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--port" && has_value) {
+            options.port = static_cast<short>(std::atoi(argv[++i]));
+        } else if (arg == "--dir" && has_value) {
+            options.dir = argv[++i];
+            options.own_dir = false;
+        } else if (arg == "--netem" && has_value) {
+            options.netem = argv[++i];
+            Netsim::Impairment::parse(options.netem);  // Fail early
+        } else if (arg == "--json" && has_value) {
+            options.json_path = argv[++i];
+        } else if (arg == "--verbose") {
+            options.verbose = true;
+        } else {
+            throw std::invalid_argument("Unknown argument: " + arg);
+        }
+    }
+    return options;
+}
+
+double cpu_seconds() {
+    timespec now{};
+    ::clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return static_cast<double>(now.tv_sec) + now.tv_nsec / 1e9;
+}
+
+// Just enough of the rendezvous for Utils::register_transfer and
+// Utils::get_transfer_metadata, plus the signal polling the sender does.
+class StubRendezvous {
+   public:
+    StubRendezvous() {
+        m_server.Post("/register", [this](const httplib::Request& req,
+                                          httplib::Response& res) {
+            const json data = json::parse(req.body);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_transfers[data["id"]] = data;
+            res.status = httplib::StatusCode::Created_201;
+        });
+        m_server.Get(R"(/getfile/([A-Za-z0-9\-]+))",
+                     [this](const httplib::Request& req,
+                            httplib::Response& res) {
+                         std::lock_guard<std::mutex> lock(m_mutex);
+                         auto it = m_transfers.find(req.matches[1]);
+                         if (it == m_transfers.end()) {
+                             res.status = httplib::StatusCode::NotFound_404;
+                             return;
+                         }
+                         res.set_content(it->second.dump(),
+                                         "application/json");
+                     });
+        m_server.Get(R"(/signal/([A-Za-z0-9\-]+))",
+                     [](const httplib::Request&, httplib::Response& res) {
+                         res.status = httplib::StatusCode::NotFound_404;
+                     });
+        m_port = m_server.bind_to_any_port("127.0.0.1");
+        m_thread = std::thread([this] { m_server.listen_after_bind(); });
+        m_server.wait_until_ready();
+    }
+
+    ~StubRendezvous() {
+        m_server.stop();
+        m_thread.join();
+    }
+
+    std::string url() const {
+        return "http://127.0.0.1:" + std::to_string(m_port);
+    }
+
+   private:
+    httplib::Server m_server;
+    std::mutex m_mutex;
+    std::map<std::string, json> m_transfers;
+    int m_port = 0;
+    std::thread m_thread;
+};
+
+// `relay` is null for a direct path
+Result run_size(Server& server, const Options& options, uint64_t size,
+                const Netsim::Relay* relay) {
+    Result result;
+    result.size = size;
+    const std::filesystem::path source =
+        options.dir / ("source_" + std::to_string(size));
+    Bench::write_file(source, size);
+
+    TRANSFERS transfer = Utils::new_transfer(
+        source.string(), Crypto::compute_file_hash(source.string()));
+    transfer.sender_ip = "127.0.0.1";
+    transfer.sender_port = static_cast<uint32_t>(options.port);
+    transfer.sender_local_ip.clear();
+    transfer.sender_local_port = 0;
+    if (!server.add_transfer(source.string(), transfer)) {
+        throw std::runtime_error("Cannot serve " + source.string());
+    }
+    Utils::register_transfer(transfer);
+
+    for (int run = 0; run < options.runs; ++run) {
+        TRANSFERS fetched = Utils::get_transfer_metadata(transfer.id);
+        if (relay) fetched.sender_port = relay->endpoint().port();
+        const std::filesystem::path output =
+            options.dir / ("received_" + std::to_string(size));
+
+        const double cpu_start = cpu_seconds();
+        const auto start = std::chrono::steady_clock::now();
+        const bool ok = receive_direct(fetched, output.string());
+        const auto end = std::chrono::steady_clock::now();
+        result.cpu_seconds += cpu_seconds() - cpu_start;
+
+        if (ok && std::filesystem::file_size(output) == size) {
+            result.seconds.push_back(
+                std::chrono::duration<double>(end - start).count());
+        } else {
+            ++result.failures;
+        }
+        std::filesystem::remove(output);
+    }
+
+    server.remove_transfer(transfer.id);
+    std::filesystem::remove(source);
+    return result;
+}
+
+double median(std::vector<double> values) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    const size_t mid = values.size() / 2;
+    return values.size() % 2 ? values[mid]
+                              : (values[mid - 1] + values[mid]) / 2;
+}
+
+json to_json(const Result& result) {
+    const double seconds = median(result.seconds);
+    const int completed = static_cast<int>(result.seconds.size());
+    const double gigabytes = static_cast<double>(result.size) / 1e9;
+    return {{"size_bytes", result.size},
+            {"runs", completed + result.failures},
+            {"failures", result.failures},
+            {"median_seconds", seconds},
+            {"min_seconds",
+             completed ? *std::min_element(result.seconds.begin(),
+                                           result.seconds.end())
+                       : 0.0},
+            {"mb_per_s", seconds > 0 ? result.size / 1e6 / seconds : 0.0},
+            {"cpu_seconds_per_gb",
+             completed ? result.cpu_seconds / completed / gigabytes : 0.0}};
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    try {
+        options = parse_options(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\nusage: zapshare_bench [--sizes 1K,1M,1G]"
+                  << " [--runs N] [--port P] [--dir DIR] [--netem SPEC]"
+                  << " [--json PATH|-] [--verbose]" << std::endl;
+        return 1;
+    }
+    std::filesystem::create_directories(options.dir);
+
+    // Keep the benchmark's keys, tickets and stats away from the user's
+    ::setenv("ZAPSHARE_IDENTITY", (options.dir / "identity.key").c_str(), 0);
+    ::setenv("ZAPSHARE_TICKET_DIR", (options.dir / "tickets").c_str(), 0);
+    ::setenv("ZAPSHARE_STATS", "off", 0);
+    Trace::start_from_env();
+    StubRendezvous rendezvous;
+    ::setenv("CENTRAL_SERVER_URL", rendezvous.url().c_str(), 1);
+
+    // The sender and receiver log every session to stdout
+    std::ostream report(std::cout.rdbuf());
+    if (!options.verbose) std::cout.rdbuf(nullptr);
+
+    std::vector<Result> results;
+    int exit_code = 0;
+    try {
+        Keys::identity();
+        Keys::start_ephemeral_pool();
+        asio::io_context io;
+        Server server(io, options.port, true);
+        server.run();
+        ThreadGuard sender{std::thread([&io] { io.run(); }),
+                           [&server] { server.shutdown(); }};
+
+        // The relay gets its own thread so its timers run on time
+        asio::io_context relay_io;
+        std::unique_ptr<Netsim::Relay> relay;
+        // Declared after the sender's, so it stops first
+        ThreadGuard relay_thread;
+        if (!options.netem.empty()) {
+            const auto impairment = Netsim::Impairment::parse(options.netem);
+            // Its own seed each way, or losses would come in lockstep
+            Netsim::Impairment backward = impairment;
+            ++backward.seed;
+            const asio::ip::address loopback =
+                asio::ip::make_address("127.0.0.1");
+            relay = std::make_unique<Netsim::Relay>(
+                relay_io, asio::ip::udp::endpoint(loopback, 0),
+                asio::ip::udp::endpoint(loopback, options.port), impairment,
+                backward);
+            relay_thread.thread =
+                std::thread([&relay_io] { relay_io.run(); });
+            relay_thread.stop = [&relay_io, &relay] {
+                asio::post(relay_io, [&relay] { relay->stop(); });
+            };
+        }
+
+        for (uint64_t size : options.sizes) {
+            results.push_back(run_size(server, options, size, relay.get()));
+            const json row = to_json(results.back());
+            char line[128];
+            std::snprintf(line, sizeof(line),
+                          "%12llu B  %9.4f s  %8.2f MB/s  %8.2f CPU s/GB",
+                          static_cast<unsigned long long>(size),
+                          row["median_seconds"].get<double>(),
+                          row["mb_per_s"].get<double>(),
+                          row["cpu_seconds_per_gb"].get<double>());
+            report << line;
+            if (results.back().failures > 0) {
+                report << "  " << results.back().failures << " failed";
+                exit_code = 1;
+            }
+            report << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        exit_code = 1;
+    }
+    std::cout.rdbuf(report.rdbuf());
+
+    if (!options.json_path.empty()) {
+        const bool secure = std::getenv("ZAPSHARE_INSECURE") == nullptr;
+        json document = {{"benchmark", "loopback"},
+                         {"secure", secure},
+                         {"netem", options.netem},
+                         {"results", json::array()}};
+        for (const Result& result : results) {
+            document["results"].push_back(to_json(result));
+        }
+        if (options.json_path == "-") {
+            std::cout << document.dump(2) << std::endl;
+        } else {
+            std::ofstream(options.json_path) << document.dump(2) << "\n";
+        }
+    }
+
+    std::error_code ec;
+    if (options.own_dir) {
+        std::filesystem::remove_all(options.dir, ec);
+    } else {
+        std::filesystem::remove(options.dir / "identity.key", ec);
+        std::filesystem::remove_all(options.dir / "tickets", ec);
+    }
+    return exit_code;
+}
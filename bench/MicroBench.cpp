@@ -0,0 +1,259 @@
+// Microbenchmarks for the pieces every data packet goes through: the AEAD,
+// the handshake signatures, the file hash and the ControlPacket codec.
+// Packet-sized cases use a full UdpConfig::PAYLOAD_SIZE payload and report
+// bytes/s alongside ns/op, so a change to one stage can be measured on its
+// own before it shows up in zapshare_bench.
+//
+// Any Google Benchmark flag works, e.g.
+//   zapshare_microbench --benchmark_filter=Aead --benchmark_format=json
+#include <benchmark/benchmark.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <span>
+#include <string>
+
+#include "crypto.hpp"
+#include "crypto/session_crypto.hpp"
+#include "secure_channel.hpp"
+#include "types.h"
+#include "v1/control.pb.h"
+
+namespace {
+
+constexpr size_t PAYLOAD = UdpConfig::PAYLOAD_SIZE;
+const std::string TRANSFER_ID = "00000000-0000-4000-8000-000000000000";
+
+std::string random_bytes(size_t size) {
+    std::mt19937_64 random(size);
+    std::string bytes(size, '\0');
+    for (char& byte : bytes) byte = static_cast<char>(random());
+    return bytes;
+}
+
+SessionKeys session_keys() {
+    const EphemeralKeyPair client = generate_ephemeral_keypair();
+    const EphemeralKeyPair server = generate_ephemeral_keypair();
+    return derive_client_keys(client, server.public_key);
+}
+
+// A data packet as the sender builds it
+zapshare::v1::ControlPacket data_packet() {
+    zapshare::v1::ControlPacket packet;
+    auto* data = packet.mutable_data();
+    data->set_transfer_id(TRANSFER_ID);
+    data->set_offset(1ULL << 30);
+    data->set_payload(random_bytes(PAYLOAD));
+    return packet;
+}
+
+void BM_EncryptPacket(benchmark::State& state) {
+    const std::string key = session_keys().tx_key;
+    const std::string plaintext = random_bytes(PAYLOAD);
+    uint64_t sequence = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(encrypt_packet(plaintext, key, sequence++));
+    }
+    state.SetBytesProcessed(state.iterations() * PAYLOAD);
+}
+BENCHMARK(BM_EncryptPacket);
+
+void BM_DecryptPacket(benchmark::State& state) {
+    const std::string key = session_keys().tx_key;
+    const std::string ciphertext =
+        encrypt_packet(random_bytes(PAYLOAD), key, 7);
+    std::string plaintext;
+    for (auto _ : state) {
+        if (!decrypt_packet(ciphertext, key, 7, &plaintext)) {
+            state.SkipWithError("decrypt_packet failed");
+            break;
+        }
+        benchmark::DoNotOptimize(plaintext.data());
+    }
+    state.SetBytesProcessed(state.iterations() * PAYLOAD);
+}
+BENCHMARK(BM_DecryptPacket);
+
+// The in-place AEAD the data path uses, per cipher
+AeadCipher cipher_arg(benchmark::State& state) {
+    const auto cipher = static_cast<AeadCipher>(state.range(0));
+    state.SetLabel(cipher == AeadCipher::Aes256Gcm ? "aes256gcm"
+                                                   : "xchacha20poly1305");
+    return cipher;
+}
+
+void BM_AeadSeal(benchmark::State& state) {
+    const AeadCipher cipher = cipher_arg(state);
+    if (cipher == AeadCipher::Aes256Gcm && !aes256gcm_available()) {
+        state.SkipWithError("no hardware AES");
+        return;
+    }
+    const AeadKey key(cipher, session_keys().tx_key);
+    std::array<char, UdpConfig::MAX_PACKET_SIZE> buffer{};
+    uint64_t sequence = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+            key.seal(buffer, PAYLOAD, sequence++, TRANSFER_ID));
+    }
+    state.SetBytesProcessed(state.iterations() * PAYLOAD);
+}
+BENCHMARK(BM_AeadSeal)
+    ->Arg(static_cast<int>(AeadCipher::XChaCha20Poly1305))
+    ->Arg(static_cast<int>(AeadCipher::Aes256Gcm));
+
+// Opening decrypts in place, so each iteration copies the sealed packet
+// back first; that copy is a few percent of the time at this size.
+void BM_AeadOpen(benchmark::State& state) {
+    const AeadCipher cipher = cipher_arg(state);
+    if (cipher == AeadCipher::Aes256Gcm && !aes256gcm_available()) {
+        state.SkipWithError("no hardware AES");
+        return;
+    }
+    const AeadKey key(cipher, session_keys().tx_key);
+    std::array<char, UdpConfig::MAX_PACKET_SIZE> sealed{};
+    const std::string plaintext = random_bytes(PAYLOAD);
+    std::memcpy(sealed.data(), plaintext.data(), PAYLOAD);
+    const size_t sealed_len = key.seal(sealed, PAYLOAD, 7, TRANSFER_ID);
+
+    std::array<char, UdpConfig::MAX_PACKET_SIZE> buffer;
+    size_t opened_len = 0;
+    for (auto _ : state) {
+        std::memcpy(buffer.data(), sealed.data(), sealed_len);
+        if (!key.open(std::span(buffer).first(sealed_len), 7, &opened_len,
+                      TRANSFER_ID)) {
+            state.SkipWithError("open failed");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * PAYLOAD);
+}
+BENCHMARK(BM_AeadOpen)
+    ->Arg(static_cast<int>(AeadCipher::XChaCha20Poly1305))
+    ->Arg(static_cast<int>(AeadCipher::Aes256Gcm));
+
+// About the size of the handshake transcript a ServerHello signs
+const std::string SIGNED_MESSAGE = random_bytes(160);
+
+void BM_Sign(benchmark::State& state) {
+    const IdentityKeyPair identity = generate_identity_keypair();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sign(SIGNED_MESSAGE, identity));
+    }
+}
+BENCHMARK(BM_Sign);
+
+void BM_VerifySignature(benchmark::State& state) {
+    const IdentityKeyPair identity = generate_identity_keypair();
+    const std::string signature = sign(SIGNED_MESSAGE, identity);
+    for (auto _ : state) {
+        if (!verify_signature(SIGNED_MESSAGE, signature,
+                              identity.public_key)) {
+            state.SkipWithError("verify_signature failed");
+            break;
+        }
+    }
+}
+BENCHMARK(BM_VerifySignature);
+
+// Hashes a file of range(0) bytes, warm in the page cache after the first
+// iteration
+void BM_ComputeFileHash(benchmark::State& state) {
+    const size_t size = static_cast<size_t>(state.range(0));
+    const std::filesystem::path path =
+        std::filesystem::temp_directory_path() /
+        ("zapshare_microbench_" + std::to_string(::getpid()));
+    {
+        const std::string block = random_bytes(1 << 20);
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        for (size_t written = 0; written < size; written += block.size()) {
+            out.write(block.data(),
+                      static_cast<std::streamsize>(
+                          std::min(block.size(), size - written)));
+        }
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Crypto::compute_file_hash(path.string()));
+    }
+    state.SetBytesProcessed(state.iterations() * size);
+    std::filesystem::remove(path);
+}
+BENCHMARK(BM_ComputeFileHash)
+    ->Arg(1 << 20)
+    ->Arg(64 << 20)
+    ->Unit(benchmark::kMillisecond);
+
+void BM_ControlPacketSerialize(benchmark::State& state) {
+    const zapshare::v1::ControlPacket packet = data_packet();
+    std::string bytes;
+    for (auto _ : state) {
+        packet.SerializeToString(&bytes);
+        benchmark::DoNotOptimize(bytes.data());
+    }
+    state.SetBytesProcessed(state.iterations() * PAYLOAD);
+}
+BENCHMARK(BM_ControlPacketSerialize);
+
+// Into one reused message, as the receive loop does
+void BM_ControlPacketParse(benchmark::State& state) {
+    const std::string bytes = data_packet().SerializeAsString();
+    zapshare::v1::ControlPacket packet;
+    for (auto _ : state) {
+        if (!packet.ParseFromString(bytes)) {
+            state.SkipWithError("parse failed");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * PAYLOAD);
+}
+BENCHMARK(BM_ControlPacketParse);
+
+// The whole per-packet path: serialize, seal and wrap on one side, unwrap,
+// open and parse on the other
+void BM_SecureChannelEncode(benchmark::State& state) {
+    SecureChannel channel(session_keys(), TRANSFER_ID,
+                          AeadCipher::XChaCha20Poly1305);
+    const zapshare::v1::ControlPacket packet = data_packet();
+    std::string datagram;
+    for (auto _ : state) {
+        if (!channel.encode(packet, &datagram)) {
+            state.SkipWithError("encode failed");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * PAYLOAD);
+}
+BENCHMARK(BM_SecureChannelEncode);
+
+// Uses open(), which skips the replay window, so one datagram can be
+// opened over and over
+void BM_SecureChannelDecode(benchmark::State& state) {
+    const SessionKeys keys = session_keys();
+    SecureChannel sender(keys, TRANSFER_ID, AeadCipher::XChaCha20Poly1305);
+    const SecureChannel receiver(SessionKeys{keys.rx_key, keys.tx_key},
+                                 TRANSFER_ID, AeadCipher::XChaCha20Poly1305);
+    std::string datagram;
+    sender.encode(data_packet(), &datagram);
+
+    SecureChannel::Scratch scratch;
+    zapshare::v1::ControlPacket packet;
+    uint64_t sequence = 0;
+    for (auto _ : state) {
+        if (!receiver.open(datagram.data(), datagram.size(), &packet,
+                           &sequence, scratch)) {
+            state.SkipWithError("decode failed");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * PAYLOAD);
+}
+BENCHMARK(BM_SecureChannelDecode);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,122 @@
+// zapshare_netem: a lossy UDP relay for testing the real binaries on one
+// machine. It listens on one port and relays to the target through a pair
+// of Netsim links, one per direction, until interrupted.
+//
+// usage: zapshare_netem --target HOST:PORT [--listen [HOST:]PORT]
+//                       [--netem SPEC] [--up SPEC] [--down SPEC]
+//
+// --netem impairs both directions alike (each with its own seed); --up
+// and --down set the receiver-to-sender and sender-to-receiver directions
+// on their own. To put it in front of a sender on the default port:
+//
+//   zapshare_netem --listen 5174 --target 127.0.0.1:5173
+//                  --netem delay=50ms,loss=2%
+//   ZAPSHARE_HOST_OVERRIDE=127.0.0.1:5174 cli_tool get SECRET
+#include <asio.hpp>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "netsim.hpp"
+
+namespace {
+
+constexpr char DEFAULT_LISTEN[] = "127.0.0.1:5174";
+
+struct Options {
+    asio::ip::udp::endpoint listen;
+    asio::ip::udp::endpoint target;
+    Netsim::Impairment up;
+    Netsim::Impairment down;
+};
+
+// "HOST:PORT", or just "PORT" on 127.0.0.1
+asio::ip::udp::endpoint parse_endpoint(const std::string& text) {
+    const size_t colon = text.rfind(':');
+    const std::string host =
+        colon == std::string::npos ? "127.0.0.1" : text.substr(0, colon);
+    const std::string port =
+        colon == std::string::npos ? text : text.substr(colon + 1);
+    try {
+        return {asio::ip::make_address(host),
+                static_cast<unsigned short>(std::stoul(port))};
+    } catch (const std::exception&) {
+        throw std::invalid_argument("Not an address: " + text);
+    }
+}
+
+Options parse_options(int argc, char* argv[]) {
+    Options options;
+    options.listen = parse_endpoint(DEFAULT_LISTEN);
+    bool has_target = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) throw std::invalid_argument("Missing value: " + arg);
+        const std::string value = argv[++i];
+        if (arg == "--listen") {
+            options.listen = parse_endpoint(value);
+        } else if (arg == "--target") {
+            options.target = parse_endpoint(value);
+            has_target = true;
+        } else if (arg == "--netem") {
+            options.up = Netsim::Impairment::parse(value);
+            // The same seed both ways would lose packets in lockstep
+            options.down = options.up;
+            ++options.down.seed;
+        } else if (arg == "--up") {
+            options.up = Netsim::Impairment::parse(value);
+        } else if (arg == "--down") {
+            options.down = Netsim::Impairment::parse(value);
+        } else {
+            throw std::invalid_argument("Unknown argument: " + arg);
+        }
+    }
+    if (!has_target) throw std::invalid_argument("--target is required");
+    return options;
+}
+
+void print_counters(const char* direction, const Netsim::Link& link) {
+    const Netsim::Link::Counters& counters = link.counters();
+    std::printf(
+        "%-5s %llu offered, %llu lost, %llu overflowed, %llu reordered, "
+        "%llu duplicated\n",
+        direction, static_cast<unsigned long long>(counters.offered),
+        static_cast<unsigned long long>(counters.lost),
+        static_cast<unsigned long long>(counters.overflowed),
+        static_cast<unsigned long long>(counters.reordered),
+        static_cast<unsigned long long>(counters.duplicated));
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    try {
+        options = parse_options(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\nusage: zapshare_netem --target HOST:PORT"
+                  << " [--listen [HOST:]PORT] [--netem SPEC] [--up SPEC]"
+                  << " [--down SPEC]" << std::endl;
+        return 1;
+    }
+
+    try {
+        asio::io_context io;
+        Netsim::Relay relay(io, options.listen, options.target, options.up,
+                            options.down);
+        std::cout << "Relaying " << relay.endpoint() << " -> "
+                  << options.target << " (Ctrl-C to stop)" << std::endl;
+
+        asio::signal_set signals(io, SIGINT, SIGTERM);
+        signals.async_wait([&](asio::error_code, int) { relay.stop(); });
+        io.run();
+
+        print_counters("up", relay.forward());
+        print_counters("down", relay.backward());
+    } catch (const std::exception& e) {
+        std::cerr << "zapshare_netem: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
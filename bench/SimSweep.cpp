@@ -0,0 +1,183 @@
+// zapshare_sim: sweeps the transport over simulated networks. Each run is
+// a whole transfer (sender Session, receive loop, handshake and crypto)
+// on Sim::Network in virtual time, so a minute-long lossy transfer takes
+// milliseconds and any run can be replayed exactly from its seed.
+//
+// usage: zapshare_sim [--size 1M] [--netem SPEC]... [--seeds N]
+//                     [--json PATH|-] [--verbose]
+//
+// Every --netem SPEC (see Netsim::Impairment::parse) runs with seeds 1 to
+// N, replacing any seed in the spec. Times are virtual: what the transfer
+// would take on that network, not what the simulation took.
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bench_util.hpp"
+#include "json/json.hpp"
+#include "netsim.hpp"
+#include "sim_transfer.hpp"
+#include "trace.hpp"
+#include "types.h"
+
+namespace {
+
+using json = nlohmann::json;
+
+constexpr char DEFAULT_SIZE[] = "1M";
+constexpr int DEFAULT_SEEDS = 5;
+const std::vector<std::string> DEFAULT_NETEMS = {
+    "delay=10ms", "delay=50ms,loss=1%", "delay=50ms,loss=5%",
+    "delay=100ms,loss=2%,burst=4", "delay=25ms,jitter=10ms,reorder=5%"};
+
+struct Options {
+    uint64_t size = 0;
+    std::vector<std::string> netems;
+    int seeds = DEFAULT_SEEDS;
+    std::string json_path;
+    bool verbose = false;
+};
+
+struct Run {
+    uint64_t seed;
+    Sim::TransferResult result;
+};
+
+Options parse_options(int argc, char* argv[]) {
+    Options options;
+    options.size = Bench::parse_size(DEFAULT_SIZE);
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--size" && has_value) {
+            options.size = Bench::parse_size(argv[++i]);
+        } else if (arg == "--netem" && has_value) {
+            options.netems.push_back(argv[++i]);
+            Netsim::Impairment::parse(options.netems.back());  // Fail early
+        } else if (arg == "--seeds" && has_value) {
+            options.seeds = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--json" && has_value) {
+            options.json_path = argv[++i];
+        } else if (arg == "--verbose") {
+            options.verbose = true;
+        } else {
+            throw std::invalid_argument("Unknown argument: " + arg);
+        }
+    }
+    if (options.netems.empty()) options.netems = DEFAULT_NETEMS;
+    return options;
+}
+
+double seconds(Sim::Clock::duration duration) {
+    return std::chrono::duration<double>(duration).count();
+}
+
+json to_json(const Run& run, uint64_t size) {
+    const Sim::TransferResult& result = run.result;
+    const double elapsed = seconds(result.elapsed);
+    const auto counters = [](const Netsim::Link::Counters& counters) {
+        return json{{"offered", counters.offered},
+                    {"lost", counters.lost},
+                    {"overflowed", counters.overflowed},
+                    {"reordered", counters.reordered},
+                    {"duplicated", counters.duplicated}};
+    };
+    return {{"seed", run.seed},
+            {"completed", result.completed},
+            {"virtual_seconds", elapsed},
+            {"mb_per_s",
+             result.completed && elapsed > 0 ? size / 1e6 / elapsed : 0.0},
+            {"up", counters(result.up)},
+            {"down", counters(result.down)}};
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    try {
+        options = parse_options(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\nusage: zapshare_sim [--size 1M]"
+                  << " [--netem SPEC]... [--seeds N] [--json PATH|-]"
+                  << " [--verbose]" << std::endl;
+        return 1;
+    }
+
+    const std::filesystem::path dir =
+        std::filesystem::temp_directory_path() /
+        ("zapshare_sim_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(dir);
+    ::setenv("ZAPSHARE_IDENTITY", (dir / "identity.key").c_str(), 0);
+    ::setenv("ZAPSHARE_TICKET_DIR", (dir / "tickets").c_str(), 0);
+    ::setenv("ZAPSHARE_STATS", "off", 0);
+    Trace::start_from_env();
+
+    // Both ends log every session to stdout
+    std::ostream report(std::cout.rdbuf());
+    if (!options.verbose) std::cout.rdbuf(nullptr);
+
+    const std::filesystem::path source = dir / "source";
+    const std::filesystem::path output = dir / "received";
+    Bench::write_file(source, options.size);
+
+    json document = {{"benchmark", "simulation"},
+                     {"size_bytes", options.size},
+                     {"secure", std::getenv("ZAPSHARE_INSECURE") == nullptr},
+                     {"results", json::array()}};
+    int exit_code = 0;
+    for (const std::string& spec : options.netems) {
+        Netsim::Impairment impairment = Netsim::Impairment::parse(spec);
+        std::vector<Run> runs;
+        std::vector<double> times;
+        for (int seed = 1; seed <= options.seeds; ++seed) {
+            impairment.seed = static_cast<uint64_t>(seed);
+            runs.push_back({impairment.seed,
+                            Sim::run_transfer(source.string(),
+                                              output.string(), impairment)});
+            if (runs.back().result.completed) {
+                times.push_back(seconds(runs.back().result.elapsed));
+            }
+        }
+        std::sort(times.begin(), times.end());
+
+        const int failures = static_cast<int>(runs.size() - times.size());
+        char line[160];
+        std::snprintf(line, sizeof(line),
+                      "%-40s  median %9.3f s  min %9.3f s  max %9.3f s",
+                      spec.c_str(), times.empty() ? 0 : times[times.size() / 2],
+                      times.empty() ? 0 : times.front(),
+                      times.empty() ? 0 : times.back());
+        report << line;
+        if (failures > 0) {
+            report << "  " << failures << " failed";
+            exit_code = 1;
+        }
+        report << std::endl;
+
+        json row = {{"netem", spec}, {"runs", json::array()}};
+        for (const Run& run : runs) {
+            row["runs"].push_back(to_json(run, options.size));
+        }
+        document["results"].push_back(std::move(row));
+    }
+    std::cout.rdbuf(report.rdbuf());
+
+    if (options.json_path == "-") {
+        std::cout << document.dump(2) << std::endl;
+    } else if (!options.json_path.empty()) {
+        std::ofstream(options.json_path) << document.dump(2) << "\n";
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+    return exit_code;
+}
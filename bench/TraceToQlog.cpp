@@ -0,0 +1,136 @@
+// zapshare_qlog: turns a ZAPSHARE_TRACE file into qlog (JSON-SEQ, one
+// record per line), for qvis or jq. Each end of each connection becomes a
+// group of its own, named by connection ID and role.
+//
+// usage: zapshare_qlog TRACE [OUTPUT|-]
+//
+// Packet events map onto qlog's transport and recovery events where one
+// fits; the rest are zapshare: events. Times are in milliseconds from the
+// first record.
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "json/json.hpp"
+#include "trace.hpp"
+
+namespace {
+
+using json = nlohmann::json;
+
+// RFC 7464 record separator
+constexpr char RECORD_SEPARATOR = '\x1e';
+
+std::vector<Trace::Record> read_trace(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("Cannot open " + path);
+    Trace::FileHeader header{};
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in || header.magic != Trace::MAGIC) {
+        throw std::runtime_error(path + " is not a zapshare trace");
+    }
+    if (header.version != Trace::VERSION ||
+        header.record_size != sizeof(Trace::Record)) {
+        throw std::runtime_error(path + " is from another zapshare version");
+    }
+    std::vector<Trace::Record> records;
+    Trace::Record record{};
+    while (in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+        records.push_back(record);
+    }
+    return records;
+}
+
+std::string group_id(const Trace::Record& record) {
+    return std::to_string(record.connection) +
+           (record.role == Trace::Role::Sender ? "-sender" : "-receiver");
+}
+
+// qlog's name and data for one record; an empty name for an unknown event
+std::pair<std::string, json> to_event(const Trace::Record& record) {
+    switch (record.event) {
+        case Trace::Event::PacketSent:
+            return {"transport:packet_sent",
+                    {{"offset", record.value},
+                     {"raw", {{"payload_length", record.extra}}}}};
+        case Trace::Event::PacketReceived:
+            return {"transport:packet_received",
+                    {{"offset", record.value},
+                     {"raw", {{"payload_length", record.extra}}}}};
+        case Trace::Event::PacketResent:
+            return {"zapshare:packet_resent", {{"offset", record.value}}};
+        case Trace::Event::AckSent:
+            return {"zapshare:ack_sent",
+                    {{"next_offset", record.value},
+                     {"complete", record.extra != 0}}};
+        case Trace::Event::AckReceived:
+            return {"zapshare:ack_received",
+                    {{"next_offset", record.value},
+                     {"complete", record.extra != 0}}};
+        case Trace::Event::Timeout:
+            return {"recovery:loss_timer_updated",
+                    {{"event_type", "expired"}, {"timeouts", record.value}}};
+        case Trace::Event::RttSample:
+            return {"recovery:metrics_updated",
+                    {{"latest_rtt", static_cast<double>(record.value) / 1e3}}};
+    }
+    return {};
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argc > 3) {
+        std::cerr << "usage: zapshare_qlog TRACE [OUTPUT|-]" << std::endl;
+        return 1;
+    }
+    std::vector<Trace::Record> records;
+    try {
+        records = read_trace(argv[1]);
+    } catch (const std::exception& e) {
+        std::cerr << "zapshare_qlog: " << e.what() << std::endl;
+        return 1;
+    }
+
+    std::ofstream file;
+    const std::string output = argc == 3 ? argv[2] : "-";
+    if (output != "-") {
+        file.open(output);
+        if (!file) {
+            std::cerr << "zapshare_qlog: cannot write " << output << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = output == "-" ? std::cout : file;
+
+    // Threads flush their rings independently, so records are only
+    // ordered within a ring
+    std::stable_sort(records.begin(), records.end(),
+                     [](const Trace::Record& a, const Trace::Record& b) {
+                         return a.time_ns < b.time_ns;
+                     });
+    const int64_t start = records.empty() ? 0 : records.front().time_ns;
+
+    const json header = {
+        {"qlog_version", "0.3"},
+        {"qlog_format", "JSON-SEQ"},
+        {"title", "zapshare"},
+        {"trace",
+         {{"vantage_point", {{"type", "unknown"}}},
+          {"common_fields", {{"time_format", "relative"}}}}}};
+    out << RECORD_SEPARATOR << header.dump() << "\n";
+    for (const Trace::Record& record : records) {
+        auto [name, data] = to_event(record);
+        if (name.empty()) continue;
+        const json event = {{"time", (record.time_ns - start) / 1e6},
+                            {"name", name},
+                            {"group_id", group_id(record)},
+                            {"data", std::move(data)}};
+        out << RECORD_SEPARATOR << event.dump() << "\n";
+    }
+    return 0;
+}
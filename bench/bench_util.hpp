@@ -0,0 +1,44 @@
+// Helpers shared by the benchmark tools
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace Bench {
+
+// "64K", "16M", "1G" in binary units, or plain bytes
+inline uint64_t parse_size(const std::string& text) {
+    size_t end = 0;
+    const uint64_t value = std::stoull(text, &end);
+    switch (end < text.size() ? std::toupper(text[end]) : 0) {
+        case 'K':
+            return value << 10;
+        case 'M':
+            return value << 20;
+        case 'G':
+            return value << 30;
+        default:
+            return value;
+    }
+}
+
+// `size` bytes of random data, the same for the same size
+inline void write_file(const std::filesystem::path& path, uint64_t size) {
+    std::vector<char> block(1 << 20);
+    std::mt19937_64 random(size);
+    for (char& byte : block) byte = static_cast<char>(random());
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    for (uint64_t written = 0; written < size; written += block.size()) {
+        const uint64_t length =
+            std::min<uint64_t>(block.size(), size - written);
+        out.write(block.data(), static_cast<std::streamsize>(length));
+    }
+}
+
+}  // namespace Bench
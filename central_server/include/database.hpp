@@ -1,9 +1,19 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <pqxx/pqxx>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "json/json.hpp"
+#include "metrics.hpp"
 
 using json = nlohmann::json;
 
@@ -34,8 +44,6 @@ struct TransferRow {
     std::string created_at;  // empty if NULL
 };
 
-static std::unique_ptr<pqxx::connection> connection;
-
 const char* get_env(const char* key) {
     const char* value = std::getenv(key);
     if (!value) {
@@ -44,24 +52,8 @@ const char* get_env(const char* key) {
     return value;
 }
 
-void init() {
-    connection = std::make_unique<pqxx::connection>(get_env("DATABASE_URL"));
-
-    if (!connection->is_open()) {
-        throw std::runtime_error("Failed to open DB connection");
-    }
-    std::cout << "Connected to Database Successfully!\n";
-}
-
-pqxx::connection& conn() {
-    if (!connection) {
-        throw std::runtime_error("DB not initialized");
-    }
-    return *connection;
-}
-
-void create_transfers_table() {
-    pqxx::work txn(conn());
+void create_transfers_table(pqxx::connection& connection) {
+    pqxx::work txn(connection);
 
     txn.exec(R"(
         CREATE TABLE IF NOT EXISTS transfers (
@@ -83,7 +75,207 @@ void create_transfers_table() {
     std::cout << " Table 'transfers' created\n";
 }
 
-void create_tables() { create_transfers_table(); }
+void create_tables(pqxx::connection& connection) { create_transfers_table(connection); }
+
+// Every query the server runs, prepared once on each connection the pool
+// opens. The tables must exist first.
+void prepare_statements(pqxx::connection& connection) {
+    connection.prepare("lookup_transfer", "SELECT 1 FROM transfers WHERE id = $1 LIMIT 1");
+    // Claims the transfer and returns it in one statement
+    connection.prepare("claim_transfer", "UPDATE transfers SET claimed = true WHERE id = $1 RETURNING *");
+    connection.prepare("register_transfer", R"(
+            INSERT INTO transfers (
+                id,
+                sender_ip,
+                sender_port,
+                protocol,
+                file_name,
+                file_size,
+                file_hash,
+                token
+            ) VALUES ($1, $2, $3, $4, $5, $6, $7, $8)
+            ON CONFLICT (id) DO UPDATE SET
+                sender_ip = EXCLUDED.sender_ip,
+                sender_port = EXCLUDED.sender_port,
+                protocol = EXCLUDED.protocol,
+                file_name = EXCLUDED.file_name,
+                file_size = EXCLUDED.file_size,
+                file_hash = EXCLUDED.file_hash,
+                token = EXCLUDED.token
+        )");
+}
+
+// A bounded pool of connections, so each worker thread runs its queries on
+// a connection of its own instead of all of them sharing one. A worker
+// checks a connection out for one request and the Lease hands it back.
+// Connections are opened on demand up to the pool's size; once they are
+// all out, a checkout waits for one to come back.
+class Pool {
+   public:
+    // A connection idle for longer than this is pinged before it is reused
+    static constexpr std::chrono::seconds HEALTH_CHECK_AFTER{30};
+    // A checkout that waits longer than this for a connection fails
+    static constexpr std::chrono::seconds ACQUIRE_TIMEOUT{5};
+
+    class Lease {
+       public:
+        Lease(Pool& pool, std::unique_ptr<pqxx::connection> connection)
+            : m_pool(&pool), m_connection(std::move(connection)) {}
+        Lease(Lease&& other) noexcept
+            : m_pool(std::exchange(other.m_pool, nullptr)),
+              m_connection(std::move(other.m_connection)),
+              m_broken(other.m_broken) {}
+        Lease& operator=(Lease&&) = delete;
+        ~Lease() {
+            if (m_pool) m_pool->release(std::move(m_connection), m_broken);
+        }
+
+        pqxx::connection& operator*() const { return *m_connection; }
+        pqxx::connection* operator->() const { return m_connection.get(); }
+
+        // Closes the connection instead of returning it to the pool
+        void discard() { m_broken = true; }
+
+       private:
+        Pool* m_pool;
+        std::unique_ptr<pqxx::connection> m_connection;
+        bool m_broken = false;
+    };
+
+    Pool(std::string url, size_t size) : m_url(std::move(url)), m_size(std::max<size_t>(1, size)) {}
+
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    // Throws if no connection comes free within ACQUIRE_TIMEOUT or a new
+    // one cannot be opened
+    Lease acquire() {
+        Metrics::QueryTimer timer("pool_acquire");
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (!m_released.wait_for(lock, ACQUIRE_TIMEOUT, [this] { return !m_idle.empty() || m_open < m_size; })) {
+            throw std::runtime_error("No database connection free");
+        }
+        if (!m_idle.empty()) {
+            Idle idle = std::move(m_idle.back());
+            m_idle.pop_back();
+            lock.unlock();
+            if (std::chrono::steady_clock::now() - idle.since < HEALTH_CHECK_AFTER || is_healthy(*idle.connection)) {
+                return Lease(*this, std::move(idle.connection));
+            }
+            // Reconnect in its place
+            Metrics::count_error("db:stale_connection");
+            idle.connection.reset();
+        } else {
+            ++m_open;
+            lock.unlock();
+        }
+        try {
+            return Lease(*this, connect());
+        } catch (...) {
+            release(nullptr, true);
+            throw;
+        }
+    }
+
+    // Connections open, and how many of them are checked out
+    size_t open() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_open;
+    }
+    size_t busy() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_open - m_idle.size();
+    }
+
+   private:
+    struct Idle {
+        std::unique_ptr<pqxx::connection> connection;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    std::unique_ptr<pqxx::connection> connect() {
+        auto connection = std::make_unique<pqxx::connection>(m_url);
+        if (!connection->is_open()) {
+            throw std::runtime_error("Failed to open DB connection");
+        }
+        prepare_statements(*connection);
+        return connection;
+    }
+
+    static bool is_healthy(pqxx::connection& connection) {
+        if (!connection.is_open()) return false;
+        try {
+            pqxx::nontransaction txn(connection);
+            txn.exec("SELECT 1");
+            return true;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+
+    // A null or broken `connection` gives up its place, so a new one can
+    // be opened
+    void release(std::unique_ptr<pqxx::connection> connection, bool broken) {
+        if (broken || !connection || !connection->is_open()) {
+            connection.reset();
+            std::lock_guard<std::mutex> lock(m_mutex);
+            --m_open;
+        } else {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            // Reused last in, first out, so the least recently used ones
+            // are the ones that go stale
+            m_idle.push_back({std::move(connection), std::chrono::steady_clock::now()});
+        }
+        m_released.notify_one();
+    }
+
+    const std::string m_url;
+    const size_t m_size;
+    std::mutex m_mutex;
+    std::condition_variable m_released;
+    std::vector<Idle> m_idle;
+    // Idle and checked out, counting ones being opened
+    size_t m_open = 0;
+};
+
+static std::unique_ptr<Pool> pool;
+
+// Creates the tables, then a pool of up to `size` connections; DB_POOL_SIZE
+// overrides it. Opens the first one straight away, so a bad DATABASE_URL
+// fails at startup.
+void init(size_t size) {
+    if (const char* env = std::getenv("DB_POOL_SIZE")) size = std::strtoul(env, nullptr, 10);
+    const std::string url = get_env("DATABASE_URL");
+    {
+        pqxx::connection connection(url);
+        create_tables(connection);
+    }
+    pool = std::make_unique<Pool>(url, size);
+    pool->acquire();
+    Metrics::registry().db_pool_open = [] { return pool->open(); };
+    Metrics::registry().db_pool_busy = [] { return pool->busy(); };
+    std::cout << "Connected to Database Successfully!\n";
+}
+
+// Runs `fn(pqxx::connection&)` on a pooled connection. A connection that
+// breaks underneath it is closed and `fn` runs once more on a new one;
+// every query here is safe to repeat.
+template <typename Fn>
+auto with_connection(Fn&& fn) {
+    if (!pool) {
+        throw std::runtime_error("DB not initialized");
+    }
+    for (int attempt = 0;; ++attempt) {
+        Pool::Lease lease = pool->acquire();
+        try {
+            return fn(*lease);
+        } catch (const pqxx::broken_connection&) {
+            lease.discard();
+            Metrics::count_error("db:broken_connection");
+            if (attempt > 0) throw;
+        }
+    }
+}
 
 // Convert pqxx::row into a TransferRow with safe defaults for NULLs
 template <typename RowLike>
@@ -147,73 +339,47 @@ void print_transfer(const TransferRow& t) {
 }
 
 bool lookup_transfer(const std::string_view secret) {
-    pqxx::read_transaction txn(conn());
-
+    Metrics::QueryTimer timer("lookup_transfer");
     try {
-        pqxx::result r = txn.exec_params("SELECT * FROM transfers WHERE id = $1", std::string(secret));
-
-        return !r.empty();
+        return with_connection([&](pqxx::connection& connection) {
+            pqxx::nontransaction txn(connection);
+            return !txn.exec_prepared("lookup_transfer", std::string(secret)).empty();
+        });
     } catch (const std::exception& e) {
+        Metrics::count_error("db:lookup_transfer");
         std::cerr << "Error: " << e.what() << "\n";
         return false;
     }
 }
 
-void mark_transfer_claimed(const std::string_view secret) {
-    pqxx::work txn(conn());
-    try {
-        txn.exec_params("UPDATE transfers SET claimed = true WHERE id = $1", std::string(secret));
-        txn.commit();
-    } catch (std::exception& e) {
-        std::cerr << "ERROR: " << e.what() << "\n";
-        throw std::runtime_error(e.what());
-    }
-}
-
+// Marks the transfer claimed and returns it, in one round trip
 TransferRow get_transfers_metadata(const std::string_view secret) {
-    pqxx::read_transaction txn(conn());
-
+    Metrics::QueryTimer timer("get_transfers_metadata");
     try {
-        pqxx::result r = txn.exec_params("SELECT * FROM transfers WHERE id = $1", std::string(secret));
-        txn.commit();
-        mark_transfer_claimed(secret);
-        TransferRow data = to_transfer_row(r[0]);
-        data.claimed = true;
-        return data;
+        return with_connection([&](pqxx::connection& connection) {
+            pqxx::nontransaction txn(connection);
+            pqxx::result r = txn.exec_prepared("claim_transfer", std::string(secret));
+            if (r.empty()) {
+                throw std::runtime_error("No transfer " + std::string(secret));
+            }
+            return to_transfer_row(r[0]);
+        });
     } catch (std::exception& e) {
         throw std::runtime_error(e.what());
     }
 }
 
 bool register_transfers(const json data) {
-    pqxx::work txn(conn());
+    Metrics::QueryTimer timer("register_transfers");
     try {
         TRANSFERS payload = transfer_row_from_json(data);
-        txn.exec_params(
-            R"(
-            INSERT INTO transfers (
-                id,
-                sender_ip,
-                sender_port,
-                protocol,
-                file_name,
-                file_size,
-                file_hash,
-                token
-            ) VALUES ($1, $2, $3, $4, $5, $6, $7, $8)
-            ON CONFLICT (id) DO UPDATE SET
-                sender_ip = EXCLUDED.sender_ip,
-                sender_port = EXCLUDED.sender_port,
-                protocol = EXCLUDED.protocol,
-                file_name = EXCLUDED.file_name,
-                file_size = EXCLUDED.file_size,
-                file_hash = EXCLUDED.file_hash,
-                token = EXCLUDED.token
-        )",
-            payload.id, payload.sender_ip, payload.sender_port, payload.protocol, payload.file_name, payload.file_size,
-            payload.file_hash, payload.token);
-
-        txn.commit();
+        with_connection([&](pqxx::connection& connection) {
+            pqxx::nontransaction txn(connection);
+            txn.exec_prepared("register_transfer", payload.id, payload.sender_ip, payload.sender_port,
+                              payload.protocol, payload.file_name, payload.file_size, payload.file_hash,
+                              payload.token);
+        });
+        return true;
     } catch (std::exception& e) {
         std::cerr << "ERROR: " << e.what() << "\n";
         throw std::runtime_error(e.what());
@@ -0,0 +1,260 @@
+#pragma once
+
+// Prometheus metrics for the rendezvous server, rendered in the text
+// exposition format by GET /metrics. Counters and histograms are keyed by
+// their label values and created on first use; the label sets are small
+// and fixed (routes, queries, error sources), so a mutex per family is
+// plenty at rendezvous request rates.
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "net/httplib.h"
+
+namespace Metrics {
+
+// Upper bounds in seconds, from a fast DB round trip to a stuck request
+inline constexpr std::array<double, 12> LATENCY_BUCKETS = {0.0005, 0.001, 0.0025, 0.005, 0.01,  0.025,
+                                                           0.05,   0.1,   0.25,   0.5,   1.0,   2.5};
+
+using Labels = std::vector<std::pair<std::string, std::string>>;
+
+inline std::string escape_label(const std::string& value) {
+    std::string escaped;
+    for (char c : value) {
+        if (c == '\\' || c == '"') escaped += '\\';
+        if (c == '\n') {
+            escaped += "\\n";
+            continue;
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+// `extra` is appended after `labels`, for a histogram's `le`
+inline std::string format_labels(const Labels& labels, const std::string& extra = "") {
+    if (labels.empty() && extra.empty()) return "";
+    std::string text = "{";
+    for (const auto& [name, value] : labels) {
+        if (text.size() > 1) text += ",";
+        text += name + "=\"" + escape_label(value) + "\"";
+    }
+    if (!extra.empty()) {
+        if (text.size() > 1) text += ",";
+        text += extra;
+    }
+    return text + "}";
+}
+
+class Histogram {
+   public:
+    void observe(double seconds) {
+        for (size_t i = 0; i < LATENCY_BUCKETS.size(); ++i) {
+            if (seconds <= LATENCY_BUCKETS[i]) {
+                m_buckets[i].fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+        }
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum_ns.fetch_add(static_cast<uint64_t>(seconds * 1e9), std::memory_order_relaxed);
+    }
+
+    void render(std::ostream& out, const std::string& name, const Labels& labels) const {
+        // Buckets are stored per range; Prometheus wants them cumulative
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < LATENCY_BUCKETS.size(); ++i) {
+            cumulative += m_buckets[i].load(std::memory_order_relaxed);
+            std::ostringstream bound;
+            bound << LATENCY_BUCKETS[i];
+            out << name << "_bucket" << format_labels(labels, "le=\"" + bound.str() + "\"") << " " << cumulative
+                << "\n";
+        }
+        const uint64_t count = m_count.load(std::memory_order_relaxed);
+        out << name << "_bucket" << format_labels(labels, "le=\"+Inf\"") << " " << count << "\n";
+        out << name << "_sum" << format_labels(labels) << " " << m_sum_ns.load(std::memory_order_relaxed) / 1e9
+            << "\n";
+        out << name << "_count" << format_labels(labels) << " " << count << "\n";
+    }
+
+   private:
+    std::array<std::atomic<uint64_t>, LATENCY_BUCKETS.size()> m_buckets{};
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_sum_ns{0};
+};
+
+// One metric name and its series, one per label set
+template <typename Series>
+class Family {
+   public:
+    Family(std::string name, std::string help, std::string type)
+        : m_name(std::move(name)), m_help(std::move(help)), m_type(std::move(type)) {}
+
+    Series& with(const Labels& labels) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto& series = m_series[labels];
+        if (!series) series = std::make_unique<Series>();
+        return *series;
+    }
+
+    void render(std::ostream& out) {
+        out << "# HELP " << m_name << " " << m_help << "\n";
+        out << "# TYPE " << m_name << " " << m_type << "\n";
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& [labels, series] : m_series) render_series(out, labels, *series);
+    }
+
+   private:
+    void render_series(std::ostream& out, const Labels& labels, const std::atomic<uint64_t>& counter) {
+        out << m_name << format_labels(labels) << " " << counter.load(std::memory_order_relaxed) << "\n";
+    }
+    void render_series(std::ostream& out, const Labels& labels, const Histogram& histogram) {
+        histogram.render(out, m_name, labels);
+    }
+
+    const std::string m_name;
+    const std::string m_help;
+    const std::string m_type;
+    std::mutex m_mutex;
+    std::map<Labels, std::unique_ptr<Series>> m_series;
+};
+
+using CounterFamily = Family<std::atomic<uint64_t>>;
+using HistogramFamily = Family<Histogram>;
+
+struct Registry {
+    CounterFamily http_requests{"zapshare_http_requests_total", "HTTP requests served, by route, method and status.",
+                                "counter"};
+    HistogramFamily http_latency{"zapshare_http_request_duration_seconds",
+                                 "Time from reading a request to writing its response, by route.", "histogram"};
+    HistogramFamily db_latency{"zapshare_db_query_duration_seconds", "Database query latency, by query.",
+                               "histogram"};
+    CounterFamily errors{"zapshare_errors_total",
+                         "Errors, by source: a route's handler, a database query, or the HTTP layer.", "counter"};
+
+    std::atomic<int64_t> queued_tasks{0};
+    std::atomic<int64_t> busy_workers{0};
+    // Sampled at scrape time, for state owned elsewhere
+    std::function<size_t()> signal_store_size;
+    std::function<size_t()> db_pool_open;
+    std::function<size_t()> db_pool_busy;
+};
+
+inline Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+// "/lookup/([A-Za-z0-9\-]+)" becomes "/lookup/:id", keeping the route
+// label readable. Unmatched paths share one label so that scanners cannot
+// grow the series without bound.
+inline std::string route_label(const httplib::Request& req) {
+    if (req.matched_route.empty()) return "unmatched";
+    const size_t group = req.matched_route.find('(');
+    if (group == std::string::npos) return req.matched_route;
+    return req.matched_route.substr(0, group) + ":id";
+}
+
+// Called from the server's logger, once the response is out
+inline void record_request(const httplib::Request& req, const httplib::Response& res) {
+    const std::string route = route_label(req);
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - req.start_time_).count();
+    Registry& metrics = registry();
+    metrics.http_requests.with({{"route", route}, {"method", req.method}, {"status", std::to_string(res.status)}})
+        .fetch_add(1, std::memory_order_relaxed);
+    metrics.http_latency.with({{"route", route}}).observe(seconds);
+}
+
+inline void count_error(const std::string& source) {
+    registry().errors.with({{"source", source}}).fetch_add(1, std::memory_order_relaxed);
+}
+
+// Times one database query; a query that throws counts as an error too
+class QueryTimer {
+   public:
+    explicit QueryTimer(std::string query)
+        : m_query(std::move(query)), m_start(std::chrono::steady_clock::now()) {}
+    ~QueryTimer() {
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+        registry().db_latency.with({{"query", m_query}}).observe(seconds);
+        if (std::uncaught_exceptions() > m_exceptions) count_error("db:" + m_query);
+    }
+
+    QueryTimer(const QueryTimer&) = delete;
+    QueryTimer& operator=(const QueryTimer&) = delete;
+
+   private:
+    const std::string m_query;
+    const std::chrono::steady_clock::time_point m_start;
+    const int m_exceptions = std::uncaught_exceptions();
+};
+
+// httplib's ThreadPool with its queue depth and busy workers counted
+class InstrumentedTaskQueue : public httplib::TaskQueue {
+   public:
+    explicit InstrumentedTaskQueue(size_t threads) : m_pool(threads) {}
+
+    bool enqueue(std::function<void()> fn) override {
+        Registry& metrics = registry();
+        metrics.queued_tasks.fetch_add(1, std::memory_order_relaxed);
+        const bool queued = m_pool.enqueue([&metrics, fn = std::move(fn)] {
+            metrics.queued_tasks.fetch_sub(1, std::memory_order_relaxed);
+            metrics.busy_workers.fetch_add(1, std::memory_order_relaxed);
+            fn();
+            metrics.busy_workers.fetch_sub(1, std::memory_order_relaxed);
+        });
+        if (!queued) metrics.queued_tasks.fetch_sub(1, std::memory_order_relaxed);
+        return queued;
+    }
+
+    void shutdown() override { m_pool.shutdown(); }
+
+   private:
+    httplib::ThreadPool m_pool;
+};
+
+inline std::string render() {
+    Registry& metrics = registry();
+    std::ostringstream out;
+    metrics.http_requests.render(out);
+    metrics.http_latency.render(out);
+    metrics.db_latency.render(out);
+    metrics.errors.render(out);
+
+    out << "# HELP zapshare_threadpool_queued_tasks Connections waiting for a worker thread.\n"
+        << "# TYPE zapshare_threadpool_queued_tasks gauge\n"
+        << "zapshare_threadpool_queued_tasks " << metrics.queued_tasks.load() << "\n";
+    out << "# HELP zapshare_threadpool_busy_workers Worker threads serving a connection.\n"
+        << "# TYPE zapshare_threadpool_busy_workers gauge\n"
+        << "zapshare_threadpool_busy_workers " << metrics.busy_workers.load() << "\n";
+    if (metrics.signal_store_size) {
+        out << "# HELP zapshare_signal_store_entries Receiver signals held for senders to poll.\n"
+            << "# TYPE zapshare_signal_store_entries gauge\n"
+            << "zapshare_signal_store_entries " << metrics.signal_store_size() << "\n";
+    }
+    if (metrics.db_pool_open) {
+        out << "# HELP zapshare_db_pool_connections Database connections open in the pool.\n"
+            << "# TYPE zapshare_db_pool_connections gauge\n"
+            << "zapshare_db_pool_connections " << metrics.db_pool_open() << "\n";
+    }
+    if (metrics.db_pool_busy) {
+        out << "# HELP zapshare_db_pool_busy_connections Pooled database connections checked out by a request.\n"
+            << "# TYPE zapshare_db_pool_busy_connections gauge\n"
+            << "zapshare_db_pool_busy_connections " << metrics.db_pool_busy() << "\n";
+    }
+    return out.str();
+}
+
+}  // namespace Metrics
@@ -4,25 +4,29 @@
 #include <thread>
 
 #include "database.hpp"
+#include "metrics.hpp"
 #include "net/httplib.h"
 #include "json/json.hpp"
 
 using json = nlohmann::json;
 
 int main() {
-    DB::init();
-    DB::create_tables();
+    // One database connection per worker thread, so a request never waits for one
+    int num_threads = std::max(2, static_cast<int>(std::thread::hardware_concurrency()));
+    DB::init(num_threads);
 
     httplib::Server svr;
     // httplib::SSLServer svr;
 
-    // Request logger
+    // Request logger, which also feeds the request metrics
     svr.set_logger([](const httplib::Request& req, const httplib::Response& res) {
+        Metrics::record_request(req, res);
         std::cout << req.method << " " << req.path << " -> " << res.status << std::endl;
     });
 
     // Error logger
     svr.set_error_logger([](const httplib::Error& err, const httplib::Request* req) {
+        Metrics::count_error("http:" + httplib::to_string(err));
         std::cerr << httplib::to_string(err) << " while processing request";
         if (req) {
             std::cerr << ", client: " << req->get_header_value("X-Forwarded-For") << ", request: '" << req->method
@@ -47,8 +51,10 @@ int main() {
         try {
             std::rethrow_exception(ep);
         } catch (std::exception& e) {
+            Metrics::count_error("exception");
             snprintf(buf, sizeof(buf), fmt, e.what());
         } catch (...) {  // See the following NOTE
+            Metrics::count_error("exception");
             snprintf(buf, sizeof(buf), fmt, "Unknown Exception");
         }
         res.set_content(buf, "text/plain");
@@ -70,6 +76,7 @@ int main() {
             res.set_content(data, "application/json");
             res.status = httplib::StatusCode::OK_200;
         } catch (std::exception& e) {
+            Metrics::count_error("getfile");
             std::cerr << "Error: " << e.what() << "\n";
         }
     });
@@ -80,6 +87,7 @@ int main() {
             DB::register_transfers(data);
             res.status = httplib::StatusCode::Created_201;
         } catch (std::exception& e) {
+            Metrics::count_error("register");
             std::cerr << "Error: " << e.what() << "\n";
         }
     });
@@ -89,6 +97,10 @@ int main() {
     // using a static map for simplicity here as DB schema update wasn't requested in plan
     static std::mutex signal_mutex;
     static std::map<std::string, json> signal_store;
+    Metrics::registry().signal_store_size = [] {
+        std::lock_guard<std::mutex> lock(signal_mutex);
+        return signal_store.size();
+    };
 
     svr.Post(R"(/signal/([A-Za-z0-9\-]+))", [](const httplib::Request& req, httplib::Response& res) {
         std::string id = req.matches[1];
@@ -101,6 +113,7 @@ int main() {
             std::cout << "Signal received for " << id << ": " << data.dump() << std::endl;
             res.status = httplib::StatusCode::OK_200;
         } catch (std::exception& e) {
+            Metrics::count_error("signal");
             std::cerr << "Error parsing signal: " << e.what() << "\n";
             res.status = httplib::StatusCode::BadRequest_400;
         }
@@ -121,9 +134,12 @@ int main() {
                         "text/plain");
     });
 
+    svr.Get("/metrics", [](const httplib::Request&, httplib::Response& res) {
+        res.set_content(Metrics::render(), "text/plain; version=0.0.4");
+    });
+
     // Enable thread pool for concurrent request handling
-    int num_threads = std::max(2, static_cast<int>(std::thread::hardware_concurrency()));
-    svr.new_task_queue = [num_threads] { return new httplib::ThreadPool(num_threads); };
+    svr.new_task_queue = [num_threads] { return new Metrics::InstrumentedTaskQueue(num_threads); };
 
     std::cout << "Server listening on 0.0.0.0:3000 with " << num_threads << " worker threads" << std::endl;
     svr.listen("0.0.0.0", 3000);
@@ -0,0 +1,274 @@
+// Fan-out read cache: every receiver of one transfer reads through a single
+// window of file blocks, filled by one read-ahead thread, so each block
+// comes off disk once no matter how many receivers are in flight.
+//
+// Readers record their position as they go. A block is only evicted once
+// every reader in the window has moved past it, so a full cache throttles
+// the leaders until the slowest reader catches up. Two kinds of reader fall
+// back to reading the file directly instead of holding the group back: one
+// that is behind the window altogether (it joined late), and one that has
+// stalled the read-ahead for longer than MAX_THROTTLE.
+#pragma once
+
+#include <algorithm>
+#include <asio.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "source_file.hpp"
+
+class ChunkCache {
+   public:
+    using ReaderId = uint64_t;
+    using Waiter = std::function<void()>;
+
+    static constexpr size_t BLOCK_SIZE = 1 << 20;
+    // Returned by read() when the block is still on its way
+    static constexpr ssize_t PENDING = -2;
+    // Longest the read-ahead waits on a slow reader before leaving it to
+    // read the file directly.
+    static constexpr std::chrono::milliseconds MAX_THROTTLE{1000};
+
+    struct Stats {
+        uint64_t blocks_loaded = 0;
+        uint64_t direct_reads = 0;
+        uint64_t throttle_waits = 0;
+    };
+
+    // `capacity_blocks` bounds memory; the read-ahead keeps up to
+    // `read_ahead_blocks` past the furthest reader.
+    ChunkCache(std::shared_ptr<const SourceFile> file, size_t capacity_blocks,
+               size_t read_ahead_blocks)
+        : m_file(std::move(file)),
+          m_capacity(std::max<size_t>(capacity_blocks, 2)),
+          m_read_ahead(std::clamp<size_t>(read_ahead_blocks, 1,
+                                          m_capacity / 2)),
+          m_block_count((m_file->size() + BLOCK_SIZE - 1) / BLOCK_SIZE) {
+        m_next_load = next_data_block(0);
+        m_loader = std::thread([this] { load_loop(); });
+    }
+
+    ~ChunkCache() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_cv.notify_all();
+        m_loader.join();
+    }
+
+    ChunkCache(const ChunkCache&) = delete;
+    ChunkCache& operator=(const ChunkCache&) = delete;
+
+    ReaderId attach() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const ReaderId id = m_next_reader++;
+        m_readers[id] = Reader{};
+        m_cv.notify_all();
+        return id;
+    }
+
+    void detach(ReaderId reader) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_readers.erase(reader);
+        }
+        m_cv.notify_all();
+    }
+
+    // Copies up to `length` bytes at `offset`, stopping at the end of a
+    // resident block. Returns the bytes copied, 0 at end of file, -1 on a
+    // read error, or PENDING when the block is not loaded yet; when_ready()
+    // then says when to try again.
+    ssize_t read(ReaderId reader, uint64_t offset, char* buffer,
+                 size_t length) {
+        if (offset >= m_file->size()) return 0;
+        const uint64_t block = offset / BLOCK_SIZE;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto reader_it = m_readers.find(reader);
+        if (reader_it == m_readers.end()) return -1;
+        Reader& state = reader_it->second;
+        if (state.block != block) {
+            state.block = block;
+            m_cv.notify_all();
+        }
+
+        // Direct readers still take blocks that happen to be resident
+        auto block_it = m_blocks.find(block);
+        if (block_it != m_blocks.end()) {
+            const std::vector<char>& data = block_it->second;
+            const size_t within = static_cast<size_t>(offset % BLOCK_SIZE);
+            if (within >= data.size()) return -1;  // Short read at load
+            const size_t n = std::min(length, data.size() - within);
+            std::memcpy(buffer, data.data() + within, n);
+            return static_cast<ssize_t>(n);
+        }
+
+        if (state.direct || block < m_evicted_below) {
+            // Already evicted: the read-ahead never goes backwards, so this
+            // reader is on its own from here on.
+            state.direct = true;
+            ++m_stats.direct_reads;
+            lock.unlock();
+            return m_file->read_at(offset, buffer, length);
+        }
+        return PENDING;
+    }
+
+    // Posts `waiter` to `executor` once the block holding `offset` is
+    // loaded, or right away if it already is or never will be. Readers on
+    // different threads pass their own executors.
+    void when_ready(uint64_t offset, asio::any_io_executor executor,
+                    Waiter waiter) {
+        const uint64_t block = offset / BLOCK_SIZE;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_blocks.count(block) && block >= m_evicted_below &&
+                block < m_block_count) {
+                m_waiters[block].push_back(
+                    {std::move(executor), std::move(waiter)});
+                m_cv.notify_all();
+                return;
+            }
+        }
+        asio::post(executor, std::move(waiter));
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+   private:
+    struct Reader {
+        uint64_t block = 0;
+        // Left the window for good: reads the file itself and no longer
+        // pins blocks
+        bool direct = false;
+    };
+
+    // Next block at or after `block` that overlaps file data; holes are
+    // never read, so they are never cached.
+    uint64_t next_data_block(uint64_t block) const {
+        const uint64_t offset = block * BLOCK_SIZE;
+        for (const auto& extent : m_file->extents()) {
+            if (extent.hole || extent.end() <= offset) continue;
+            return std::max(block, extent.offset / BLOCK_SIZE);
+        }
+        return m_block_count;
+    }
+
+    // Caller holds the lock.
+    bool wants_block(uint64_t block) const {
+        if (block >= m_block_count) return false;
+        if (m_waiters.count(block)) return true;
+        for (const auto& [id, reader] : m_readers) {
+            if (!reader.direct && block <= reader.block + m_read_ahead) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Lowest block a windowed reader still needs. Caller holds the lock.
+    uint64_t pinned_floor() const {
+        uint64_t floor = UINT64_MAX;
+        for (const auto& [id, reader] : m_readers) {
+            if (!reader.direct) floor = std::min(floor, reader.block);
+        }
+        return floor;
+    }
+
+    // Makes room for one more block, evicting from the low end. Returns
+    // false while every resident block is still pinned. Caller holds the
+    // lock.
+    bool make_room() {
+        while (m_blocks.size() >= m_capacity) {
+            auto lowest = m_blocks.begin();
+            if (lowest->first >= pinned_floor()) return false;
+            m_evicted_below = lowest->first + 1;
+            m_blocks.erase(lowest);
+        }
+        return true;
+    }
+
+    // Gives up on the readers pinning the lowest block. Caller holds the
+    // lock.
+    void release_slowest() {
+        const uint64_t floor = pinned_floor();
+        for (auto& [id, reader] : m_readers) {
+            if (!reader.direct && reader.block == floor) reader.direct = true;
+        }
+    }
+
+    void load_loop() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;) {
+            m_cv.wait(lock, [this] {
+                return m_stopping || wants_block(m_next_load);
+            });
+            if (m_stopping) return;
+
+            if (!make_room()) {
+                ++m_stats.throttle_waits;
+                if (!m_cv.wait_for(lock, MAX_THROTTLE, [this] {
+                        return m_stopping || m_blocks.size() < m_capacity ||
+                               m_blocks.begin()->first < pinned_floor();
+                    })) {
+                    release_slowest();
+                }
+                continue;
+            }
+
+            const uint64_t block = m_next_load;
+            lock.unlock();
+            const uint64_t offset = block * BLOCK_SIZE;
+            std::vector<char> data(static_cast<size_t>(
+                std::min<uint64_t>(BLOCK_SIZE, m_file->size() - offset)));
+            const ssize_t n = m_file->read_at(offset, data.data(), data.size());
+            data.resize(n > 0 ? static_cast<size_t>(n) : 0);
+            lock.lock();
+
+            m_blocks.emplace(block, std::move(data));
+            ++m_stats.blocks_loaded;
+            m_next_load = next_data_block(block + 1);
+
+            auto waiters = m_waiters.find(block);
+            if (waiters != m_waiters.end()) {
+                for (auto& [executor, waiter] : waiters->second) {
+                    asio::post(executor, std::move(waiter));
+                }
+                m_waiters.erase(waiters);
+            }
+        }
+    }
+
+    std::shared_ptr<const SourceFile> m_file;
+    const size_t m_capacity;
+    const size_t m_read_ahead;
+    const uint64_t m_block_count;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::map<uint64_t, std::vector<char>> m_blocks;
+    std::map<uint64_t,
+             std::vector<std::pair<asio::any_io_executor, Waiter>>>
+        m_waiters;
+    std::map<ReaderId, Reader> m_readers;
+    ReaderId m_next_reader = 0;
+    uint64_t m_next_load = 0;
+    // Blocks below this have been evicted and will not be loaded again
+    uint64_t m_evicted_below = 0;
+    bool m_stopping = false;
+    Stats m_stats;
+    std::thread m_loader;
+};
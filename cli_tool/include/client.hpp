@@ -1,8 +1,26 @@
 // Client session to fetch a file from a peer using the custom protocol.
 #pragma once
 
+#include <asio.hpp>
 #include <cstdint>
 #include <string>
 
+#include "transport.hpp"
+#include "types.h"
+
+#ifndef ZAPSHARE_SIMULATION
 bool run_client_session(const std::string& token,
                         const std::string& output_filename);
+
+// Fetches `transfer` straight from its sender_ip:sender_port, skipping
+// STUN, signalling and hole punching: for a sender on the same host or
+// network, such as the loopback benchmark.
+bool receive_direct(const TRANSFERS& transfer,
+                    const std::string& output_filename);
+#endif
+
+// receive_direct() over a socket the caller has opened on `io`. The
+// simulation uses it to receive over a Sim::Socket.
+bool receive_via(asio::io_context& io, Transport::Socket& socket,
+                 const TRANSFERS& transfer,
+                 const std::string& output_filename);
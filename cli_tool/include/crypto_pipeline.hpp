@@ -0,0 +1,150 @@
+// Worker pool that seals packet batches off the asio I/O thread. A batch is
+// split into slices across the workers; once every slice is done the
+// completion is posted back to the io_context. Batches from different
+// sessions complete independently; a session keeps its packets in order by
+// having at most one batch in flight.
+#pragma once
+
+#include <algorithm>
+#include <asio.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "secure_channel.hpp"
+#include "v1/control.pb.h"
+
+class CryptoPipeline {
+   public:
+    struct SealJob {
+        const zapshare::v1::ControlPacket* packet;
+        uint64_t sequence;
+        std::string* datagram;
+        bool ok;
+    };
+
+    // Below this many packets per slice the hand-off costs more than it
+    // saves, so small batches use fewer workers.
+    static constexpr size_t MIN_SLICE = 8;
+
+    CryptoPipeline(asio::any_io_executor executor, size_t threads)
+        : m_executor(std::move(executor)) {
+        for (size_t i = 0; i < threads; ++i) {
+            m_workers.emplace_back([this] { worker_loop(); });
+        }
+    }
+
+    ~CryptoPipeline() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_cv.notify_all();
+        for (auto& worker : m_workers) worker.join();
+    }
+
+    CryptoPipeline(const CryptoPipeline&) = delete;
+    CryptoPipeline& operator=(const CryptoPipeline&) = delete;
+
+    // ZAPSHARE_CRYPTO_THREADS overrides the worker count; 0 keeps all
+    // crypto on the I/O thread.
+    static size_t default_thread_count() {
+        if (const char* env = std::getenv("ZAPSHARE_CRYPTO_THREADS")) {
+            return static_cast<size_t>(std::strtoul(env, nullptr, 10));
+        }
+        const size_t cores = std::thread::hardware_concurrency();
+        return cores > 1 ? std::min<size_t>(cores - 1, 4) : 0;
+    }
+
+    size_t thread_count() const { return m_workers.size(); }
+
+    // `channel` and `jobs` must stay alive until `on_done` runs on the
+    // io_context. Must be called from the I/O thread.
+    void seal_batch(const SecureChannel& channel, std::span<SealJob> jobs,
+                    std::function<void()> on_done) {
+        submit(
+            jobs.size(),
+            [&channel, jobs](size_t begin, size_t end) {
+                thread_local SecureChannel::Scratch scratch;
+                for (size_t i = begin; i < end; ++i) {
+                    SealJob& job = jobs[i];
+                    job.ok = channel.seal(*job.packet, job.sequence,
+                                          job.datagram, scratch);
+                }
+            },
+            std::move(on_done));
+    }
+
+   private:
+    struct Batch {
+        std::function<void(size_t, size_t)> work;
+        std::function<void()> on_done;
+        std::atomic<size_t> pending{0};
+    };
+
+    struct Slice {
+        std::shared_ptr<Batch> batch;
+        size_t begin;
+        size_t end;
+    };
+
+    void submit(size_t count, std::function<void(size_t, size_t)> work,
+                std::function<void()> on_done) {
+        auto batch = std::make_shared<Batch>();
+        batch->work = std::move(work);
+        batch->on_done = std::move(on_done);
+
+        const size_t slices = std::max<size_t>(
+            1, std::min(m_workers.size(), count / MIN_SLICE));
+        if (m_workers.empty() || count == 0) {
+            batch->work(0, count);
+            asio::post(m_executor, [batch] { batch->on_done(); });
+            return;
+        }
+
+        batch->pending = slices;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            const size_t per_slice = (count + slices - 1) / slices;
+            for (size_t begin = 0; begin < count; begin += per_slice) {
+                m_queue.push_back(
+                    {batch, begin, std::min(count, begin + per_slice)});
+            }
+        }
+        m_cv.notify_all();
+    }
+
+    void worker_loop() {
+        for (;;) {
+            Slice slice;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock,
+                          [this] { return m_stopping || !m_queue.empty(); });
+                if (m_stopping && m_queue.empty()) return;
+                slice = std::move(m_queue.front());
+                m_queue.pop_front();
+            }
+            slice.batch->work(slice.begin, slice.end);
+            if (--slice.batch->pending == 0) {
+                asio::post(m_executor,
+                           [batch = slice.batch] { batch->on_done(); });
+            }
+        }
+    }
+
+    asio::any_io_executor m_executor;
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<Slice> m_queue;
+    bool m_stopping = false;
+};
@@ -0,0 +1,42 @@
+// Long-running sender. `zapshare daemon` keeps one Server up and offers any
+// number of files through it, driven over a local control socket, so the
+// per-`send` startup (identity, ephemeral key pool, socket, STUN lookup and
+// file hashing) is paid once and reused. While a daemon is running,
+// `zapshare send` hands its file to the daemon and returns right away.
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "json/json.hpp"
+
+namespace Daemon {
+
+// How long a cached STUN result is trusted before asking again
+inline constexpr std::chrono::seconds STUN_REFRESH{300};
+// Transfers retire after ZAPSHARE_TRANSFER_TTL_SECS, by default this long
+inline constexpr std::chrono::seconds DEFAULT_TRANSFER_TTL{24 * 3600};
+// Longest control request accepted
+inline constexpr size_t MAX_REQUEST_BYTES = 64 * 1024;
+
+// ZAPSHARE_DAEMON_SOCKET, else ~/.cache/zapshare/daemon.sock
+std::filesystem::path socket_path();
+
+// One request/reply over the control socket. Nullopt when no daemon is
+// listening.
+std::optional<nlohmann::json> request(const nlohmann::json& command);
+
+// Offers `file_path` through a running daemon and returns its secret.
+// Nullopt when no daemon is running; throws if the daemon refuses it.
+std::optional<std::string> offer(const std::string& file_path);
+
+// Serves until a stop request. Returns the process exit code.
+int run();
+
+// `zapshare daemon list|stop|cancel <secret>`. Returns the exit code.
+int control(const std::vector<std::string>& args);
+
+}  // namespace Daemon
@@ -2,7 +2,11 @@
 
 namespace Error {
 inline void print_usage() {
-    std::cerr << "usage:\n" << "    zapshare send [filepath]\n" << "    zapshare get [secret]\n";
+    std::cerr << "usage:\n"
+              << "    zapshare send [filepath]\n"
+              << "    zapshare get [secret]\n"
+              << "    zapshare daemon [list|stop|cancel [secret]|"
+                 "trace [path|off]]\n";
 }
 
 inline void invalid_secret() {
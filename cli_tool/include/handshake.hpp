@@ -0,0 +1,123 @@
+// Transcripts signed by each side of the ClientHello/ServerHello exchange.
+// Both peers need both builders: one to sign their own hello and one to
+// verify the other side's.
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "crypto/session_crypto.hpp"
+#include "v1/handshake.pb.h"
+
+namespace Handshake {
+
+inline std::string client_hello_transcript(
+    const zapshare::v1::ClientHello& hello) {
+    std::string transcript = "";
+    transcript += "client_hello";
+    transcript += std::to_string(hello.version());
+    transcript += hello.transfer_id();
+    transcript += hello.token();
+    transcript += hello.receiver_nonce();
+    const auto& identity = hello.receiver_identity();
+    transcript += identity.long_term_public_key();
+    transcript += identity.ephemeral_public_key();
+    if (hello.secure_transport()) transcript += "secure_transport";
+    for (int suite : hello.cipher_suites()) {
+        transcript += "cipher_suite" + std::to_string(suite);
+    }
+    return transcript;
+}
+
+inline std::string server_hello_transcript(
+    const zapshare::v1::ServerHello& hello) {
+    std::string transcript = "";
+    transcript += "server_hello";
+    transcript += std::to_string(hello.version());
+    transcript += hello.transfer_id();
+    transcript += hello.sender_nonce();
+    const auto& identity = hello.sender_identity();
+    transcript += identity.long_term_public_key();
+    transcript += identity.ephemeral_public_key();
+    if (hello.secure_transport()) transcript += "secure_transport";
+    if (hello.cipher_suite() != zapshare::v1::CIPHER_SUITE_UNSPECIFIED) {
+        transcript += "cipher_suite" + std::to_string(hello.cipher_suite());
+    }
+    if (!hello.resumption_ticket().empty()) {
+        transcript += "resumption_ticket" + hello.resumption_ticket();
+        transcript += std::to_string(hello.ticket_lifetime());
+    }
+    if (hello.connection_id() != 0) {
+        transcript += "connection_id" + std::to_string(hello.connection_id());
+    }
+    return transcript;
+}
+
+inline std::string sign_client_hello(const zapshare::v1::ClientHello& hello,
+                                     const IdentityKeyPair& receiver_identity) {
+    return sign(client_hello_transcript(hello), receiver_identity);
+}
+
+inline std::string sign_server_hello(const zapshare::v1::ServerHello& hello,
+                                     const IdentityKeyPair& sender_identity) {
+    return sign(server_hello_transcript(hello), sender_identity);
+}
+
+inline bool verify_client_hello(const zapshare::v1::ClientHello& hello) {
+    return verify_signature(client_hello_transcript(hello),
+                            hello.receiver_signature(),
+                            hello.receiver_identity().long_term_public_key());
+}
+
+inline bool verify_server_hello(const zapshare::v1::ServerHello& hello) {
+    return verify_signature(server_hello_transcript(hello),
+                            hello.sender_signature(),
+                            hello.sender_identity().long_term_public_key());
+}
+
+// Suites this host can run, most preferred first. AES-256-GCM only leads
+// when the CPU has hardware AES; without it XChaCha20 is the faster one.
+inline std::vector<zapshare::v1::CipherSuite> supported_cipher_suites() {
+    std::vector<zapshare::v1::CipherSuite> suites;
+    if (aes256gcm_available()) {
+        suites.push_back(zapshare::v1::CIPHER_SUITE_AES_256_GCM);
+    }
+    suites.push_back(zapshare::v1::CIPHER_SUITE_XCHACHA20_POLY1305);
+    return suites;
+}
+
+// Sender side choice: AES-256-GCM when both ends have hardware AES,
+// XChaCha20-Poly1305 otherwise. Receivers that predate negotiation send no
+// list and only speak XChaCha20. UNSPECIFIED means there is no common suite.
+inline zapshare::v1::CipherSuite select_cipher_suite(
+    const zapshare::v1::ClientHello& hello) {
+    const auto& offered = hello.cipher_suites();
+    if (offered.empty()) return zapshare::v1::CIPHER_SUITE_XCHACHA20_POLY1305;
+
+    auto offers = [&](zapshare::v1::CipherSuite suite) {
+        return std::find(offered.begin(), offered.end(), suite) !=
+               offered.end();
+    };
+    if (aes256gcm_available() &&
+        offers(zapshare::v1::CIPHER_SUITE_AES_256_GCM)) {
+        return zapshare::v1::CIPHER_SUITE_AES_256_GCM;
+    }
+    if (offers(zapshare::v1::CIPHER_SUITE_XCHACHA20_POLY1305)) {
+        return zapshare::v1::CIPHER_SUITE_XCHACHA20_POLY1305;
+    }
+    return zapshare::v1::CIPHER_SUITE_UNSPECIFIED;
+}
+
+inline AeadCipher to_aead_cipher(zapshare::v1::CipherSuite suite) {
+    return suite == zapshare::v1::CIPHER_SUITE_AES_256_GCM
+               ? AeadCipher::Aes256Gcm
+               : AeadCipher::XChaCha20Poly1305;
+}
+
+inline const char* cipher_name(AeadCipher cipher) {
+    return cipher == AeadCipher::Aes256Gcm ? "AES-256-GCM"
+                                           : "XChaCha20-Poly1305";
+}
+
+}  // namespace Handshake
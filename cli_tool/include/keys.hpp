@@ -0,0 +1,49 @@
+// Process-wide key material: the long-term identity, read from disk once,
+// and the pool of pre-generated ephemeral key pairs used by handshakes.
+#pragma once
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include "crypto/keypair_pool.hpp"
+#include "crypto/session_crypto.hpp"
+
+namespace Keys {
+
+inline constexpr size_t EPHEMERAL_POOL_SIZE = 64;
+
+// ZAPSHARE_IDENTITY overrides the default ~/.config/zapshare/identity.key
+inline std::string identity_path() {
+    if (const char* path = std::getenv("ZAPSHARE_IDENTITY")) return path;
+    if (const char* home = std::getenv("HOME")) {
+        return std::string(home) + "/.config/zapshare/identity.key";
+    }
+    return "zapshare_identity.key";
+}
+
+inline const IdentityKeyPair& identity() {
+    static const IdentityKeyPair identity =
+        load_or_create_identity(identity_path());
+    return identity;
+}
+
+inline std::unique_ptr<EphemeralKeyPool>& ephemeral_pool_slot() {
+    static std::unique_ptr<EphemeralKeyPool> pool;
+    return pool;
+}
+
+// Only long-running senders serve enough handshakes to be worth a refill
+// thread, so the pool is opt-in. Call before any handshake thread starts.
+inline void start_ephemeral_pool(size_t capacity = EPHEMERAL_POOL_SIZE) {
+    if (!ephemeral_pool_slot()) {
+        ephemeral_pool_slot() = std::make_unique<EphemeralKeyPool>(capacity);
+    }
+}
+
+inline EphemeralKeyPair take_ephemeral() {
+    if (auto& pool = ephemeral_pool_slot()) return pool->take();
+    return generate_ephemeral_keypair();
+}
+
+}  // namespace Keys
@@ -0,0 +1,439 @@
+// A simulated network path, for measuring the transport under delay and
+// loss without root, tc or netem. A Link decides the fate of each datagram
+// offered to it: dropped (at random, in bursts, or by a full queue), late
+// (delay, jitter, the bandwidth cap, reordering) or doubled. Its decisions
+// come from a seeded generator and the times it is given, so the same
+// seed and the same traffic always meet the same network.
+//
+// A Relay puts a pair of Links between two real UDP sockets in the same
+// process: point a receiver at relay.endpoint() instead of the sender and
+// every datagram both ways crosses the simulated path. Session and the
+// receive loop talk to plain asio sockets, so nothing in them changes.
+//
+// Impairments are written the way netem takes them, as a comma-separated
+// list such as "delay=50ms,jitter=5ms,loss=2%,burst=4,rate=20mbit".
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <asio.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace Netsim {
+
+using Clock = std::chrono::steady_clock;
+
+// Every field at its default is a perfect wire
+struct Impairment {
+    // One-way; the round trip is twice this when both directions match
+    Clock::duration delay{0};
+    // Each packet's delay varies uniformly by up to this either way, so
+    // jitter wider than the packet spacing reorders on its own
+    Clock::duration jitter{0};
+    // Long-run fraction of packets lost
+    double loss = 0;
+    // Mean run of consecutive losses; 1 loses packets independently
+    double burst = 1;
+    // Fraction of packets held back by reorder_gap, letting later ones
+    // overtake them
+    double reorder = 0;
+    Clock::duration reorder_gap{std::chrono::milliseconds(10)};
+    double duplicate = 0;
+    // Bits per second; 0 for no cap
+    uint64_t rate = 0;
+    // Bytes waiting behind the rate cap before new packets are dropped
+    size_t queue = 256 * 1024;
+    uint64_t seed = 1;
+
+    // "delay=50ms,jitter=5ms,loss=2%,burst=4,reorder=1%,reorder_gap=10ms,
+    // duplicate=0.1%,rate=20mbit,queue=64k,seed=7". Throws
+    // std::invalid_argument for anything it cannot read.
+    static Impairment parse(const std::string& spec) {
+        Impairment impairment;
+        std::stringstream stream(spec);
+        std::string item;
+        while (std::getline(stream, item, ',')) {
+            if (item.empty()) continue;
+            const size_t equals = item.find('=');
+            if (equals == std::string::npos) {
+                throw std::invalid_argument("Expected key=value: " + item);
+            }
+            const std::string key = item.substr(0, equals);
+            const std::string value = item.substr(equals + 1);
+            if (key == "delay") {
+                impairment.delay = parse_duration(value);
+            } else if (key == "jitter") {
+                impairment.jitter = parse_duration(value);
+            } else if (key == "loss") {
+                impairment.loss = parse_fraction(value);
+            } else if (key == "burst") {
+                impairment.burst = std::max(1.0, parse_number(value));
+            } else if (key == "reorder") {
+                impairment.reorder = parse_fraction(value);
+            } else if (key == "reorder_gap") {
+                impairment.reorder_gap = parse_duration(value);
+            } else if (key == "duplicate") {
+                impairment.duplicate = parse_fraction(value);
+            } else if (key == "rate") {
+                impairment.rate = parse_rate(value);
+            } else if (key == "queue") {
+                impairment.queue = parse_bytes(value);
+            } else if (key == "seed") {
+                impairment.seed = static_cast<uint64_t>(parse_number(value));
+            } else {
+                throw std::invalid_argument("Unknown impairment: " + key);
+            }
+        }
+        if (impairment.loss >= 1) {
+            throw std::invalid_argument("loss must be below 100%");
+        }
+        return impairment;
+    }
+
+   private:
+    // Parses all of `text` as a number, returning what follows it
+    static double parse_number(const std::string& text,
+                               std::string* unit = nullptr) {
+        size_t end = 0;
+        double value = 0;
+        try {
+            value = std::stod(text, &end);
+        } catch (const std::exception&) {
+            throw std::invalid_argument("Not a number: " + text);
+        }
+        if (value < 0) throw std::invalid_argument("Negative: " + text);
+        if (unit) {
+            *unit = text.substr(end);
+        } else if (end != text.size()) {
+            throw std::invalid_argument("Not a number: " + text);
+        }
+        return value;
+    }
+
+    // "2%" or "0.02"
+    static double parse_fraction(const std::string& text) {
+        std::string unit;
+        const double value = parse_number(text, &unit);
+        if (unit == "%") return value / 100;
+        if (unit.empty() && value <= 1) return value;
+        throw std::invalid_argument("Not a fraction: " + text);
+    }
+
+    // "50ms", "1.5s", "200us"; milliseconds without a unit
+    static Clock::duration parse_duration(const std::string& text) {
+        std::string unit;
+        const double value = parse_number(text, &unit);
+        double seconds = 0;
+        if (unit == "s") {
+            seconds = value;
+        } else if (unit == "ms" || unit.empty()) {
+            seconds = value / 1e3;
+        } else if (unit == "us") {
+            seconds = value / 1e6;
+        } else {
+            throw std::invalid_argument("Unknown time unit: " + text);
+        }
+        return std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(seconds));
+    }
+
+    // "20mbit", "1gbit", "512kbit", or bits per second
+    static uint64_t parse_rate(const std::string& text) {
+        std::string unit;
+        const double value = parse_number(text, &unit);
+        if (unit == "gbit") return static_cast<uint64_t>(value * 1e9);
+        if (unit == "mbit") return static_cast<uint64_t>(value * 1e6);
+        if (unit == "kbit") return static_cast<uint64_t>(value * 1e3);
+        if (unit.empty() || unit == "bit") return static_cast<uint64_t>(value);
+        throw std::invalid_argument("Unknown rate unit: " + text);
+    }
+
+    // "64k", "1m" in binary units, or bytes
+    static size_t parse_bytes(const std::string& text) {
+        std::string unit;
+        const double value = parse_number(text, &unit);
+        if (unit == "k") return static_cast<size_t>(value * 1024);
+        if (unit == "m") return static_cast<size_t>(value * 1024 * 1024);
+        if (unit.empty()) return static_cast<size_t>(value);
+        throw std::invalid_argument("Unknown size unit: " + text);
+    }
+};
+
+// What became of one datagram: up to two copies, each with its arrival
+// time
+struct Fate {
+    size_t copies = 0;
+    std::array<Clock::time_point, 2> arrive_at{};
+};
+
+// One direction of a path
+class Link {
+   public:
+    struct Counters {
+        uint64_t offered = 0;
+        uint64_t lost = 0;
+        // Dropped because the queue behind the rate cap was full
+        uint64_t overflowed = 0;
+        uint64_t reordered = 0;
+        uint64_t duplicated = 0;
+    };
+
+    explicit Link(const Impairment& impairment)
+        : m_impairment(impairment), m_random(impairment.seed) {
+        // Gilbert-Elliott with every packet lost in the bad state: bursts
+        // last `burst` packets on average and the time spent bad comes to
+        // `loss` overall.
+        const double burst = std::max(1.0, impairment.burst);
+        m_leave_bad = 1 / burst;
+        m_enter_bad = impairment.loss * m_leave_bad / (1 - impairment.loss);
+    }
+
+    // Offers a `bytes`-long datagram to the link at `now`. Times must not
+    // go backwards.
+    Fate transmit(Clock::time_point now, size_t bytes) {
+        ++m_counters.offered;
+        Fate fate;
+        if (lose()) {
+            ++m_counters.lost;
+            return fate;
+        }
+
+        // Serialised behind whatever the rate cap has queued
+        Clock::time_point departs = now;
+        if (m_impairment.rate > 0) {
+            const Clock::time_point start = std::max(now, m_busy_until);
+            const double backlog =
+                std::chrono::duration<double>(start - now).count() *
+                m_impairment.rate / 8;
+            if (backlog + bytes > m_impairment.queue) {
+                ++m_counters.overflowed;
+                return fate;
+            }
+            m_busy_until =
+                start + std::chrono::duration_cast<Clock::duration>(
+                            std::chrono::duration<double>(
+                                bytes * 8.0 / m_impairment.rate));
+            departs = m_busy_until;
+        }
+
+        fate.arrive_at[fate.copies++] = departs + next_delay();
+        if (chance(m_impairment.duplicate)) {
+            ++m_counters.duplicated;
+            fate.arrive_at[fate.copies++] = departs + next_delay();
+        }
+        return fate;
+    }
+
+    const Counters& counters() const { return m_counters; }
+
+   private:
+    bool chance(double probability) {
+        return probability > 0 && m_uniform(m_random) < probability;
+    }
+
+    bool lose() {
+        if (m_impairment.loss <= 0) return false;
+        if (m_impairment.burst <= 1) return chance(m_impairment.loss);
+        m_bad = m_bad ? !chance(m_leave_bad) : chance(m_enter_bad);
+        return m_bad;
+    }
+
+    Clock::duration next_delay() {
+        Clock::duration delay = m_impairment.delay;
+        if (m_impairment.jitter.count() > 0) {
+            const double spread = (m_uniform(m_random) * 2 - 1) *
+                                  m_impairment.jitter.count();
+            delay = std::max(
+                Clock::duration(0),
+                delay + Clock::duration(static_cast<Clock::rep>(spread)));
+        }
+        if (chance(m_impairment.reorder)) {
+            ++m_counters.reordered;
+            delay += m_impairment.reorder_gap;
+        }
+        return delay;
+    }
+
+    const Impairment m_impairment;
+    std::mt19937_64 m_random;
+    std::uniform_real_distribution<double> m_uniform{0, 1};
+    double m_enter_bad = 0;
+    double m_leave_bad = 1;
+    bool m_bad = false;
+    Clock::time_point m_busy_until{};
+    Counters m_counters;
+};
+
+// Relays UDP between clients and one target through simulated links, all
+// on the caller's io_context. Each client gets its own socket towards the
+// target, so the target sees one address per client just as it would
+// without the relay. Both links are shared by every client, the way a
+// bottleneck is.
+class Relay {
+   public:
+    // Listens on `listen`; port 0 picks a free one
+    Relay(asio::io_context& io, const asio::ip::udp::endpoint& listen,
+          const asio::ip::udp::endpoint& target, const Impairment& forward,
+          const Impairment& backward)
+        : m_io(io),
+          m_target(target),
+          m_socket(io, listen),
+          m_timer(io),
+          m_forward(forward),
+          m_backward(backward) {
+        receive_from_clients();
+    }
+
+    Relay(const Relay&) = delete;
+    Relay& operator=(const Relay&) = delete;
+
+    // Where clients should send instead of the target
+    asio::ip::udp::endpoint endpoint() const {
+        return m_socket.local_endpoint();
+    }
+
+    // Client to target
+    const Link& forward() const { return m_forward; }
+    // Target to client
+    const Link& backward() const { return m_backward; }
+
+    // Drops whatever is still in flight. Call on the io_context's thread,
+    // or once it has stopped; the relay must outlive the handlers this
+    // cancels.
+    void stop() {
+        m_stopped = true;
+        asio::error_code ec;
+        m_socket.close(ec);
+        for (auto& [client, flow] : m_flows) flow->socket.close(ec);
+        m_timer.cancel();
+        m_in_flight = {};
+    }
+
+   private:
+    struct Flow {
+        explicit Flow(asio::io_context& io)
+            : socket(io, asio::ip::udp::endpoint(asio::ip::udp::v4(), 0)) {}
+
+        asio::ip::udp::socket socket;
+        asio::ip::udp::endpoint client;
+        asio::ip::udp::endpoint sender;
+        std::array<char, 65536> buffer;
+    };
+
+    struct InFlight {
+        Clock::time_point arrive_at;
+        // Breaks ties in arrival time in the order packets were sent
+        uint64_t order;
+        std::shared_ptr<const std::string> data;
+        asio::ip::udp::socket* from;
+        asio::ip::udp::endpoint to;
+
+        bool operator>(const InFlight& other) const {
+            return arrive_at != other.arrive_at ? arrive_at > other.arrive_at
+                                                : order > other.order;
+        }
+    };
+
+    void receive_from_clients() {
+        m_socket.async_receive_from(
+            asio::buffer(m_buffer), m_client,
+            [this](asio::error_code ec, size_t bytes) {
+                if (m_stopped) return;
+                if (!ec) {
+                    Flow& flow = flow_for(m_client);
+                    send(m_forward, std::string(m_buffer.data(), bytes),
+                         flow.socket, m_target);
+                }
+                receive_from_clients();
+            });
+    }
+
+    Flow& flow_for(const asio::ip::udp::endpoint& client) {
+        auto it = m_flows.find(client);
+        if (it != m_flows.end()) return *it->second;
+        auto flow = std::make_unique<Flow>(m_io);
+        flow->client = client;
+        receive_from_target(*flow);
+        return *m_flows.emplace(client, std::move(flow)).first->second;
+    }
+
+    void receive_from_target(Flow& flow) {
+        flow.socket.async_receive_from(
+            asio::buffer(flow.buffer), flow.sender,
+            [this, &flow](asio::error_code ec, size_t bytes) {
+                if (m_stopped) return;
+                if (!ec) {
+                    send(m_backward, std::string(flow.buffer.data(), bytes),
+                         m_socket, flow.client);
+                }
+                receive_from_target(flow);
+            });
+    }
+
+    void send(Link& link, std::string datagram, asio::ip::udp::socket& from,
+              const asio::ip::udp::endpoint& to) {
+        const Fate fate = link.transmit(Clock::now(), datagram.size());
+        if (fate.copies == 0) return;
+        auto data = std::make_shared<const std::string>(std::move(datagram));
+        for (size_t i = 0; i < fate.copies; ++i) {
+            m_in_flight.push({fate.arrive_at[i], m_sent++, data, &from, to});
+        }
+        schedule();
+    }
+
+    // One timer for everything in flight, set for the earliest arrival
+    void schedule() {
+        if (m_in_flight.empty()) return;
+        const Clock::time_point next = m_in_flight.top().arrive_at;
+        if (m_timer_armed && next >= m_timer_at) return;
+        m_timer_armed = true;
+        m_timer_at = next;
+        m_timer.expires_at(next);
+        m_timer.async_wait([this](asio::error_code ec) {
+            if (ec || m_stopped) return;
+            m_timer_armed = false;
+            deliver_due();
+        });
+    }
+
+    void deliver_due() {
+        const Clock::time_point now = Clock::now();
+        while (!m_in_flight.empty() && m_in_flight.top().arrive_at <= now) {
+            const InFlight& packet = m_in_flight.top();
+            asio::error_code ec;
+            packet.from->send_to(asio::buffer(*packet.data), packet.to, 0, ec);
+            m_in_flight.pop();
+        }
+        schedule();
+    }
+
+    asio::io_context& m_io;
+    const asio::ip::udp::endpoint m_target;
+    asio::ip::udp::socket m_socket;
+    asio::ip::udp::endpoint m_client;
+    std::array<char, 65536> m_buffer;
+    std::map<asio::ip::udp::endpoint, std::unique_ptr<Flow>> m_flows;
+
+    asio::steady_timer m_timer;
+    bool m_timer_armed = false;
+    Clock::time_point m_timer_at;
+    std::priority_queue<InFlight, std::vector<InFlight>, std::greater<>>
+        m_in_flight;
+    uint64_t m_sent = 0;
+
+    Link m_forward;
+    Link m_backward;
+    bool m_stopped = false;
+};
+
+}  // namespace Netsim
@@ -0,0 +1,130 @@
+// Receive buffers for a sender socket, recycled instead of freed, so the
+// steady-state receive path allocates nothing: a datagram is received into
+// a pooled buffer and that same buffer travels to its session's inbox (or
+// another shard's) by reference.
+//
+// Buffers carry their own reference count. Dropping the last reference
+// puts the buffer back on its pool's shelf from whichever thread that
+// happens on; a buffer outliving its pool frees itself instead.
+#pragma once
+
+#include <array>
+#include <asio.hpp>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "types.h"
+
+class ReceiveBuffer {
+   public:
+    // Owning handle, like a shared_ptr whose count lives in the buffer
+    class Ptr {
+       public:
+        Ptr() = default;
+        explicit Ptr(ReceiveBuffer* buffer) : m_buffer(buffer) {
+            if (m_buffer) {
+                m_buffer->m_refs.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        Ptr(const Ptr& other) : Ptr(other.m_buffer) {}
+        Ptr(Ptr&& other) noexcept
+            : m_buffer(std::exchange(other.m_buffer, nullptr)) {}
+        Ptr& operator=(Ptr other) noexcept {
+            std::swap(m_buffer, other.m_buffer);
+            return *this;
+        }
+        ~Ptr() {
+            if (m_buffer) m_buffer->release();
+        }
+
+        ReceiveBuffer* operator->() const { return m_buffer; }
+        ReceiveBuffer& operator*() const { return *m_buffer; }
+        explicit operator bool() const { return m_buffer != nullptr; }
+
+       private:
+        ReceiveBuffer* m_buffer = nullptr;
+    };
+
+    // Where idle buffers wait. Shared by the pool and its buffers.
+    struct Shelf {
+        // Idle buffers kept beyond this are freed, so a burst does not pin
+        // its peak memory for good.
+        static constexpr size_t MAX_IDLE = 1024;
+
+        std::mutex mutex;
+        std::vector<ReceiveBuffer*> idle;
+        bool closed = false;
+    };
+
+    explicit ReceiveBuffer(std::shared_ptr<Shelf> shelf)
+        : m_shelf(std::move(shelf)) {}
+
+    ReceiveBuffer(const ReceiveBuffer&) = delete;
+    ReceiveBuffer& operator=(const ReceiveBuffer&) = delete;
+
+    // The whole buffer, to receive into
+    asio::mutable_buffer storage() { return asio::buffer(m_data); }
+    // What was received, once set_size() has recorded its length
+    std::string_view view() const { return {m_data.data(), m_size}; }
+    void set_size(size_t size) { m_size = size; }
+
+    asio::ip::udp::endpoint sender;
+
+   private:
+    void release() {
+        if (m_refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        Shelf& shelf = *m_shelf;
+        {
+            std::lock_guard<std::mutex> lock(shelf.mutex);
+            if (!shelf.closed && shelf.idle.size() < Shelf::MAX_IDLE) {
+                shelf.idle.push_back(this);
+                return;
+            }
+        }
+        delete this;
+    }
+
+    std::array<char, UdpConfig::MAX_PACKET_SIZE> m_data;
+    size_t m_size = 0;
+    std::atomic<uint32_t> m_refs{0};
+    const std::shared_ptr<Shelf> m_shelf;
+};
+
+class ReceivePool {
+   public:
+    ReceivePool() : m_shelf(std::make_shared<ReceiveBuffer::Shelf>()) {}
+
+    ~ReceivePool() {
+        std::vector<ReceiveBuffer*> idle;
+        {
+            std::lock_guard<std::mutex> lock(m_shelf->mutex);
+            m_shelf->closed = true;
+            idle.swap(m_shelf->idle);
+        }
+        for (ReceiveBuffer* buffer : idle) delete buffer;
+    }
+
+    ReceivePool(const ReceivePool&) = delete;
+    ReceivePool& operator=(const ReceivePool&) = delete;
+
+    // An idle buffer, or a new one while every buffer is in use
+    ReceiveBuffer::Ptr acquire() {
+        {
+            std::lock_guard<std::mutex> lock(m_shelf->mutex);
+            if (!m_shelf->idle.empty()) {
+                ReceiveBuffer* buffer = m_shelf->idle.back();
+                m_shelf->idle.pop_back();
+                return ReceiveBuffer::Ptr(buffer);
+            }
+        }
+        return ReceiveBuffer::Ptr(new ReceiveBuffer(m_shelf));
+    }
+
+   private:
+    const std::shared_ptr<ReceiveBuffer::Shelf> m_shelf;
+};
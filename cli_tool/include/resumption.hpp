@@ -0,0 +1,217 @@
+// Session resumption. After a full handshake the sender issues a ticket
+// (its copy of the resumption secret, sealed under a key only it holds).
+// A returning receiver sends the ticket back in a ResumeHello together with
+// its first request, which skips the token lookup, the key exchange and a
+// round trip.
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include "crypto/session_crypto.hpp"
+#include "json/json.hpp"
+#include "v1/handshake.pb.h"
+
+namespace Resumption {
+
+inline constexpr uint32_t TICKET_LIFETIME_SECS = 3600;
+
+// Attempts at a 0-RTT reconnect before falling back to a full handshake
+inline constexpr int RESUME_RETRIES = 5;
+
+inline uint64_t unix_now() {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count());
+}
+
+// Sender side. The ticket key lives only in memory, so tickets die with
+// the sender process. Thread-safe: every sender shard shares one issuer.
+class TicketIssuer {
+   public:
+    TicketIssuer() : m_key(random_nonce(32)) {}
+
+    std::string issue(const std::string& transfer_id,
+                      const std::string& resumption_secret,
+                      zapshare::v1::CipherSuite suite) const {
+        zapshare::v1::ResumptionTicket ticket;
+        ticket.set_transfer_id(transfer_id);
+        ticket.set_resumption_secret(resumption_secret);
+        ticket.set_cipher_suite(suite);
+        ticket.set_expires_at(unix_now() + TICKET_LIFETIME_SECS);
+        std::string plaintext;
+        ticket.SerializeToString(&plaintext);
+        return encrypt_packet(plaintext, m_key, 0);
+    }
+
+    // Opens and checks a ResumeHello's ticket. Each receiver nonce is only
+    // honoured once, so a captured ResumeHello cannot be replayed to make
+    // us send the same keystream again.
+    std::optional<zapshare::v1::ResumptionTicket> redeem(
+        const zapshare::v1::ResumeHello& hello,
+        const std::string& transfer_id) {
+        std::string plaintext;
+        zapshare::v1::ResumptionTicket ticket;
+        const uint64_t now = unix_now();
+        if (hello.receiver_nonce().size() < 16 ||
+            !decrypt_packet(hello.ticket(), m_key, 0, &plaintext) ||
+            !ticket.ParseFromString(plaintext) ||
+            ticket.transfer_id() != transfer_id ||
+            ticket.transfer_id() != hello.transfer_id() ||
+            ticket.expires_at() < now) {
+            return std::nullopt;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::erase_if(m_seen_nonces,
+                      [now](const auto& seen) { return seen.second < now; });
+        if (!m_seen_nonces.emplace(hello.receiver_nonce(), ticket.expires_at())
+                 .second) {
+            return std::nullopt;
+        }
+        return ticket;
+    }
+
+   private:
+    std::string m_key;
+    std::mutex m_mutex;
+    std::map<std::string, uint64_t> m_seen_nonces;  // Nonce -> expiry
+};
+
+// Receiver side: what a resumption needs, cached per transfer on disk.
+struct CachedTicket {
+    std::string ticket;
+    std::string resumption_secret;
+    zapshare::v1::CipherSuite cipher_suite;
+    uint64_t expires_at = 0;
+    std::string peer_ip;
+    uint16_t peer_port = 0;
+    std::string file_name;
+    std::string file_hash;
+};
+
+// ZAPSHARE_TICKET_DIR overrides the default ~/.cache/zapshare/tickets
+inline std::filesystem::path ticket_dir() {
+    if (const char* dir = std::getenv("ZAPSHARE_TICKET_DIR")) return dir;
+    if (const char* home = std::getenv("HOME")) {
+        return std::filesystem::path(home) / ".cache/zapshare/tickets";
+    }
+    return "zapshare_tickets";
+}
+
+inline std::filesystem::path ticket_path(const std::string& transfer_id) {
+    // Transfer ids come from the command line; keep them to one component
+    if (transfer_id.find_first_of("/\\") != std::string::npos ||
+        transfer_id.empty() || transfer_id[0] == '.') {
+        return {};
+    }
+    return ticket_dir() / (transfer_id + ".json");
+}
+
+inline std::string to_hex(const std::string& bytes) {
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(bytes.size() * 2);
+    for (unsigned char c : bytes) {
+        hex += digits[c >> 4];
+        hex += digits[c & 0xf];
+    }
+    return hex;
+}
+
+inline std::string from_hex(const std::string& hex) {
+    std::string bytes;
+    if (hex.size() % 2 != 0) return bytes;
+    bytes.reserve(hex.size() / 2);
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        bytes += static_cast<char>(std::stoi(hex.substr(i, 2), nullptr, 16));
+    }
+    return bytes;
+}
+
+inline void forget_ticket(const std::string& transfer_id) {
+    const auto path = ticket_path(transfer_id);
+    std::error_code ec;
+    if (!path.empty()) std::filesystem::remove(path, ec);
+}
+
+// Best effort: a ticket that cannot be saved just means no resumption.
+inline void store_ticket(const std::string& transfer_id,
+                         const CachedTicket& cached) {
+    const auto path = ticket_path(transfer_id);
+    if (path.empty()) return;
+    std::error_code ec;
+    if (!std::filesystem::exists(path.parent_path(), ec)) {
+        std::filesystem::create_directories(path.parent_path(), ec);
+        std::filesystem::permissions(path.parent_path(),
+                                     std::filesystem::perms::owner_all, ec);
+    }
+
+    nlohmann::json data;
+    data["ticket"] = to_hex(cached.ticket);
+    data["resumption_secret"] = to_hex(cached.resumption_secret);
+    data["cipher_suite"] = static_cast<int>(cached.cipher_suite);
+    data["expires_at"] = cached.expires_at;
+    data["peer_ip"] = cached.peer_ip;
+    data["peer_port"] = cached.peer_port;
+    data["file_name"] = cached.file_name;
+    data["file_hash"] = cached.file_hash;
+
+    // The secret is key material: the file is owner-only before it holds
+    // any, and one that cannot be made so is left empty
+    const int fd = ::open(path.c_str(),
+                          O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+                          S_IRUSR | S_IWUSR);
+    if (fd < 0) return;
+    if (::fchmod(fd, S_IRUSR | S_IWUSR) == 0) {
+        const std::string bytes = data.dump();
+        size_t written = 0;
+        while (written < bytes.size()) {
+            const ssize_t n =
+                ::write(fd, bytes.data() + written, bytes.size() - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            written += static_cast<size_t>(n);
+        }
+    }
+    ::close(fd);
+}
+
+// Expired or unreadable tickets are dropped.
+inline std::optional<CachedTicket> load_ticket(const std::string& transfer_id) {
+    const auto path = ticket_path(transfer_id);
+    std::ifstream in(path);
+    if (path.empty() || !in) return std::nullopt;
+    try {
+        const nlohmann::json data = nlohmann::json::parse(in);
+        CachedTicket cached;
+        cached.ticket = from_hex(data.at("ticket"));
+        cached.resumption_secret = from_hex(data.at("resumption_secret"));
+        cached.cipher_suite = static_cast<zapshare::v1::CipherSuite>(
+            data.at("cipher_suite").get<int>());
+        cached.expires_at = data.at("expires_at");
+        cached.peer_ip = data.at("peer_ip");
+        cached.peer_port = data.at("peer_port");
+        cached.file_name = data.at("file_name");
+        cached.file_hash = data.at("file_hash");
+        if (cached.expires_at > unix_now()) return cached;
+    } catch (const std::exception&) {
+    }
+    forget_ticket(transfer_id);
+    return std::nullopt;
+}
+
+}  // namespace Resumption
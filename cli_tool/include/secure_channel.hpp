@@ -0,0 +1,196 @@
+// Encodes control packets for the wire once the handshake is done. With
+// session keys the ControlPacket is sealed in place and carried in a
+// SecurePacket; without them the channel falls back to plain serialization
+// so peers that did not negotiate secure_transport keep working.
+#pragma once
+
+#include <google/protobuf/io/coded_stream.h>
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "crypto/replay_window.hpp"
+#include "crypto/session_crypto.hpp"
+#include "types.h"
+#include "v1/control.pb.h"
+
+class SecureChannel {
+   public:
+    // Working memory for one seal/open. The channel owns one for the I/O
+    // thread; crypto workers bring their own so the const seal()/open()
+    // paths can run concurrently.
+    struct Scratch {
+        std::array<char, UdpConfig::MAX_PACKET_SIZE> buffer;
+        zapshare::v1::SecurePacket wire;
+    };
+
+    SecureChannel() = default;
+    SecureChannel(const SessionKeys& keys, std::string transfer_id,
+                  AeadCipher cipher = AeadCipher::XChaCha20Poly1305)
+        : m_tx_key(AeadKey(cipher, keys.tx_key)),
+          m_rx_key(AeadKey(cipher, keys.rx_key)),
+          m_transfer_id(std::move(transfer_id)) {}
+
+    bool is_secure() const { return m_tx_key.has_value(); }
+
+    // Stamped on every sealed packet once the sender has assigned one
+    void set_connection_id(uint64_t connection_id) {
+        m_connection_id = connection_id;
+    }
+    uint64_t connection_id() const { return m_connection_id; }
+    AeadCipher cipher() const { return m_tx_key->cipher(); }
+
+    // Sequence numbers are handed out on the I/O thread so the wire order
+    // is decided there even when sealing happens elsewhere.
+    uint64_t next_sequence() { return m_tx_sequence++; }
+
+    // Every call consumes a fresh sequence number, so retransmissions must
+    // be re-encoded rather than resent: the peer's replay window drops a
+    // sequence it has already seen.
+    bool encode(const zapshare::v1::ControlPacket& packet,
+                std::string* datagram) {
+        if (!is_secure()) return packet.SerializeToString(datagram);
+        return seal(packet, next_sequence(), datagram, m_scratch);
+    }
+
+    // Seals a run of packets back to back, reusing `datagrams` storage.
+    bool encode_batch(std::span<const zapshare::v1::ControlPacket> packets,
+                      std::vector<std::string>* datagrams) {
+        datagrams->resize(packets.size());
+        for (size_t i = 0; i < packets.size(); ++i) {
+            if (!encode(packets[i], &(*datagrams)[i])) return false;
+        }
+        return true;
+    }
+
+    bool decode(const char* data, size_t size,
+                zapshare::v1::ControlPacket* packet) {
+        if (!is_secure()) return parse_control(data, size, packet);
+
+        // Replay check first: a stale sequence costs no decryption
+        zapshare::v1::SecurePacket& wire = m_scratch.wire;
+        if (!parse_wire(data, size, &wire) ||
+            !m_replay.can_accept(wire.sequence()) ||
+            !open_wire(&wire, packet)) {
+            return false;
+        }
+        m_replay.accept(wire.sequence());
+        return true;
+    }
+
+    // Thread-safe sealing under an explicit sequence from next_sequence().
+    bool seal(const zapshare::v1::ControlPacket& packet, uint64_t sequence,
+              std::string* datagram, Scratch& scratch) const {
+        if (!is_secure()) return packet.SerializeToString(datagram);
+
+        const size_t plaintext_len = packet.ByteSizeLong();
+        if (plaintext_len + AEAD_TAG_BYTES > scratch.buffer.size() ||
+            !packet.SerializeToArray(scratch.buffer.data(),
+                                     static_cast<int>(plaintext_len))) {
+            return false;
+        }
+
+        const size_t sealed_len = m_tx_key->seal(
+            scratch.buffer, plaintext_len, sequence, m_transfer_id);
+
+        scratch.wire.set_version(zapshare::v1::PROTOCOL_VERSION_1);
+        scratch.wire.set_transfer_id(m_transfer_id);
+        scratch.wire.set_sequence(sequence);
+        scratch.wire.set_connection_id(m_connection_id);
+        scratch.wire.set_ciphertext(scratch.buffer.data(), sealed_len);
+        return scratch.wire.SerializeToString(datagram);
+    }
+
+    // Thread-safe opening without the replay check, so it accepts repeats.
+    // Measures the AEAD and parse on their own; receiving goes through
+    // decode().
+    bool open(const char* data, size_t size,
+              zapshare::v1::ControlPacket* packet, uint64_t* sequence,
+              Scratch& scratch) const {
+        if (!is_secure()) {
+            *sequence = 0;
+            return parse_control(data, size, packet);
+        }
+        if (!parse_wire(data, size, &scratch.wire) ||
+            !open_wire(&scratch.wire, packet)) {
+            return false;
+        }
+        *sequence = scratch.wire.sequence();
+        return true;
+    }
+
+   private:
+    bool parse_wire(const char* data, size_t size,
+                    zapshare::v1::SecurePacket* wire) const {
+        return wire->ParseFromArray(data, static_cast<int>(size)) &&
+               wire->version() == zapshare::v1::PROTOCOL_VERSION_1 &&
+               wire->transfer_id() == m_transfer_id;
+    }
+
+    // Opened in place inside the parsed message's own buffer
+    bool open_wire(zapshare::v1::SecurePacket* wire,
+                   zapshare::v1::ControlPacket* packet) const {
+        std::string* ciphertext = wire->mutable_ciphertext();
+        size_t plaintext_len = 0;
+        return m_rx_key->open(*ciphertext, wire->sequence(), &plaintext_len,
+                              m_transfer_id) &&
+               parse_control(ciphertext->data(), plaintext_len, packet);
+    }
+
+    // ParseFromArray, except that a packet of the same kind as the one
+    // already in `packet` is parsed into its existing body. ParseFromArray
+    // frees the oneof body and allocates it (and its strings) afresh, which
+    // for a reused message would cost allocations on every datagram.
+    static bool parse_control(const char* data, size_t size,
+                              zapshare::v1::ControlPacket* packet) {
+        google::protobuf::Message* body = mutable_body(packet);
+        // Bodies are fields 1-6 and length-delimited, so each has a
+        // one-byte tag. Anything that does not open with the current body,
+        // or carried unknown fields last time, takes the full parse.
+        const uint8_t body_tag =
+            static_cast<uint8_t>((packet->body_case() << 3) | 2);
+        if (!body || size == 0 || static_cast<uint8_t>(data[0]) != body_tag ||
+            !packet->GetReflection()->GetUnknownFields(*packet).empty()) {
+            return packet->ParseFromArray(data, static_cast<int>(size));
+        }
+        body->Clear();
+        google::protobuf::io::CodedInputStream input(
+            reinterpret_cast<const uint8_t*>(data), static_cast<int>(size));
+        return packet->MergeFromCodedStream(&input) &&
+               input.ConsumedEntireMessage();
+    }
+
+    static google::protobuf::Message* mutable_body(
+        zapshare::v1::ControlPacket* packet) {
+        using zapshare::v1::ControlPacket;
+        switch (packet->body_case()) {
+            case ControlPacket::kGet:
+                return packet->mutable_get();
+            case ControlPacket::kAck:
+                return packet->mutable_ack();
+            case ControlPacket::kData:
+                return packet->mutable_data();
+            case ControlPacket::kDone:
+                return packet->mutable_done();
+            case ControlPacket::kError:
+                return packet->mutable_error();
+            case ControlPacket::kHole:
+                return packet->mutable_hole();
+            case ControlPacket::BODY_NOT_SET:
+                break;
+        }
+        return nullptr;
+    }
+
+    std::optional<AeadKey> m_tx_key;
+    std::optional<AeadKey> m_rx_key;
+    std::string m_transfer_id;
+    uint64_t m_connection_id = 0;
+    uint64_t m_tx_sequence = 0;
+    ReplayWindow m_replay;
+    Scratch m_scratch;
+};
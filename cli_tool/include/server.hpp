@@ -1,26 +1,167 @@
 #pragma once
 
 #include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk_cache.hpp"
+#include "crypto_pipeline.hpp"
+#include "receive_pool.hpp"
+#include "resumption.hpp"
+#include "session.hpp"
+#include "telemetry.hpp"
+#include "types.h"
 
 using asio::ip::tcp;
 
+struct EndpointHash {
+    size_t operator()(const asio::ip::udp::endpoint& endpoint) const {
+        const asio::ip::address address = endpoint.address();
+        size_t hash = address.is_v4()
+                          ? std::hash<uint32_t>{}(address.to_v4().to_uint())
+                          : std::hash<std::string>{}(address.to_string());
+        return hash ^ (std::hash<uint16_t>{}(endpoint.port()) << 1);
+    }
+};
+
+class Server;
+
+// One socket and the sessions on it, all driven by a single io_context
+// thread. Sharded senders bind every shard's socket to the same port with
+// SO_REUSEPORT; the kernel then steers each receiver address to a fixed
+// shard, and connection IDs carry the packets that land elsewhere.
+class ServerShard {
+   public:
+    ServerShard(Server& server, asio::io_context& io_context, size_t index, short port, bool reuse_port,
+                const SenderContext& shared, size_t crypto_threads);
+
+    void start();
+    // The rest are thread-safe: they post to the shard's own thread
+    void stop();
+    void route(uint64_t connection_id, ReceiveBuffer::Ptr datagram);
+    void drop_duplicates(std::string hello_nonce, asio::ip::udp::endpoint keep);
+
+    asio::ip::udp::socket& socket() { return m_socket; }
+
+   private:
+    void do_receive();
+    void dispatch(ReceiveBuffer::Ptr datagram);
+    void route_by_connection_id(ReceiveBuffer::Ptr datagram);
+    void erase_session(const asio::ip::udp::endpoint& endpoint, bool finished);
+    void schedule_check();
+    uint64_t next_connection_id() const;
+
+    // Hooks the sessions call from their coroutines
+    void session_authenticated(Session& session);
+    void session_transferring(Session& session);
+    void session_moved(Session& session, const asio::ip::udp::endpoint& previous);
+    void session_ended(Session& session, bool completed);
+
+    Server& m_server;
+    const size_t m_index;
+    ReceivePool m_pool;
+    asio::ip::udp::socket m_socket;
+    asio::steady_timer m_check_timer;
+    std::unique_ptr<CryptoPipeline> m_pipeline;
+    SenderContext m_context;
+
+    std::unordered_map<asio::ip::udp::endpoint, std::shared_ptr<Session>, EndpointHash> m_sessions;
+    std::unordered_map<uint64_t, std::shared_ptr<Session>> m_connections;
+    bool m_stopped = false;
+};
+
+// Serves files to any number of receivers. Each receiver endpoint gets its
+// own Session, bound by its hello to one of the transfers on offer; all of
+// them share the socket, the crypto workers and the ticket key. By default
+// everything runs on the caller's io_context; ZAPSHARE_SHARDS=N (or
+// "auto", one per core) spreads sessions over N shards, each with its own
+// socket and thread pinned to a core.
+//
+// A one-shot sender offers a single transfer and stops once its receivers
+// are done. A daemon keeps running, retiring transfers as they expire or
+// reach their receiver limit, until shutdown().
 class Server {
+   public:
+    // Bounds each shard's table against floods of hellos from spoofed
+    // endpoints
+    static constexpr size_t MAX_SESSIONS = 1024;
+    // Give up if no receiver shows up at all
+    static constexpr std::chrono::seconds FIRST_PEER_TIMEOUT{30};
+    // Connection IDs carry the owning shard in their low byte
+    static constexpr size_t MAX_SHARDS = 256;
+
    private:
+    friend class ServerShard;
+
     bool m_Initialized;
-    asio::ip::udp::socket m_socket;
-    std::string m_file_path;
-    asio::ip::udp::endpoint m_remote_endpoint;
+    const bool m_daemon;
+    Resumption::TicketIssuer m_tickets;
+    // Shard 0 runs on the caller's io_context, the others on their own.
+    // Declared first so they outlive the fan-out caches' pending waiters.
+    std::vector<std::unique_ptr<asio::io_context>> m_shard_contexts;
+    std::mutex m_transfers_mutex;
+    std::unordered_map<std::string, std::shared_ptr<ServedFile>> m_transfers;
+    std::unique_ptr<Telemetry::Sampler> m_sampler;
+    SenderContext m_context;
+    std::vector<std::unique_ptr<ServerShard>> m_shards;
+    std::vector<std::thread> m_shard_threads;
+
+    std::atomic<size_t> m_active_sessions{0};
+    std::atomic<size_t> m_sessions_started{0};
+    std::atomic<size_t> m_sessions_finished{0};
+    std::chrono::steady_clock::time_point m_started_at;
+    std::atomic<std::chrono::steady_clock::time_point> m_idle_since;
+    // How long to keep serving once the last receiver is done
+    std::chrono::seconds m_linger;
+    std::atomic<bool> m_stopped{false};
+
+    // Hello nonce -> connection ID of the session transferring for it.
+    // Lets a shard drop a duplicate path whose hello arrives after the
+    // winning session has already started.
+    std::mutex m_claims_mutex;
+    std::unordered_map<std::string, uint64_t> m_claimed_hellos;
+
+    // Rendezvous polling runs on its own thread so new receivers can be
+    // hole-punched while transfers are in flight.
+    std::thread m_signal_thread;
+    std::mutex m_signal_mutex;
+    std::condition_variable m_signal_cv;
+    bool m_signal_stopping = false;
 
    private:
-    void do_receive();
+    void session_opened();
+    void session_closed(bool finished);
+    void claim_hello(const Session& session);
+    bool is_claimed_elsewhere(const Session& session);
+    void release_hello(const Session& session);
+    std::shared_ptr<ServedFile> find_transfer(const std::string& id);
+    void retire_transfers();
+    void check_done();
+    void stop();
+    void watch_signals();
 
    public:
     bool is_Initialized() const { return m_Initialized; }
     ~Server();
-    Server(asio::io_context& io_context, short port, const std::string& file_path);
-    void run(const std::string& transfer_id);
-    
-    private:
-     std::shared_ptr<class Session> m_session;
+    Server(asio::io_context& io_context, short port, bool daemon = false);
+    void run();
+
+    // Thread-safe. Offers `file_path` under transfer.id; false if the file
+    // cannot be opened. A zero `ttl` never expires.
+    bool add_transfer(const std::string& file_path, const TRANSFERS& transfer, uint32_t max_receivers = 0,
+                      std::chrono::seconds ttl = std::chrono::seconds(0));
+    // Thread-safe. Sessions already serving it run to completion.
+    bool remove_transfer(const std::string& id);
+    std::vector<std::shared_ptr<const ServedFile>> transfers();
+    // Thread-safe
+    void shutdown() { stop(); }
+    // Receivers that acked the whole file
+    size_t receivers_finished() const { return m_sessions_finished; }
 };
@@ -1,15 +1,34 @@
 #pragma once
 
+#include <openssl/crypto.h>
+
 #include <array>
 #include <asio.hpp>
-#include <fstream>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#include "chunk_cache.hpp"
 #include "crypto/session_crypto.hpp"
+#include "crypto_pipeline.hpp"
+#include "handshake.hpp"
+#include "keys.hpp"
+#include "receive_pool.hpp"
+#include "resumption.hpp"
+#include "secure_channel.hpp"
+#include "source_file.hpp"
+#include "sparse.hpp"
+#include "telemetry.hpp"
+#include "trace.hpp"
+#include "transport.hpp"
 #include "types.h"
 #include "utils.hpp"
 #include "v1/control.pb.h"
@@ -19,46 +38,335 @@ using asio::ip::udp;
 
 enum class State { WaitingHello, Authenticated, Transferring, Closed };
 
-namespace {
-std::string sign_server_hello(const zapshare::v1::ServerHello& hello,
-                              const IdentityKeyPair& sender_identity) {
-    std::string transcript = "";
-    transcript += "server_hello";
-    transcript += std::to_string(hello.version());
-    transcript += hello.transfer_id();
-    transcript += hello.sender_nonce();
-    const auto& identity = hello.sender_identity();
-    transcript += identity.long_term_public_key();
-    transcript += identity.ephemeral_public_key();
-    return sign(transcript, sender_identity);
-}
-}  // namespace
+// A file on offer and what the sessions serving it share. Sessions hold
+// it by shared_ptr, so withdrawing a transfer lets those in flight finish.
+struct ServedFile {
+    // Opened once and read by every session
+    std::shared_ptr<const SourceFile> file;
+    // The sender's own record of the transfer: the token is checked against
+    // it and resumed sessions are served from it without a lookup.
+    TRANSFERS transfer{};
+    // Fan-out mode: sessions read through one shared cache. Null reads the
+    // file directly.
+    std::unique_ptr<ChunkCache> cache;
+    // Receivers to serve before the transfer retires; 0 for no limit
+    uint32_t max_receivers = 0;
+    std::chrono::steady_clock::time_point expires_at =
+        std::chrono::steady_clock::time_point::max();
+
+    std::atomic<uint32_t> receivers_started{0};
+    std::atomic<uint32_t> receivers_completed{0};
+
+    bool is_retired() const {
+        return (max_receivers != 0 && receivers_completed >= max_receivers) ||
+               std::chrono::steady_clock::now() >= expires_at;
+    }
+};
+
+class Session;
+
+// Sender-wide state shared by its sessions. Owned by the Server and
+// outlives every Session.
+struct SenderContext {
+    // Finds the file a hello asks for; null for a transfer id that is not
+    // on offer (or no longer is).
+    std::function<std::shared_ptr<ServedFile>(const std::string&)>
+        find_transfer;
+    // Null seals batches inline on the I/O thread
+    CryptoPipeline* pipeline = nullptr;
+    // Null disables resumption tickets
+    Resumption::TicketIssuer* tickets = nullptr;
+    // Null leaves transfers unreported
+    Telemetry::Sampler* sampler = nullptr;
+
+    // Called by a session's coroutine as it moves along, on its executor's
+    // thread; any may be left empty. The session is authenticated once its
+    // hello checks out and transferring once the receiver asks for the
+    // file.
+    std::function<void(Session&)> on_authenticated;
+    std::function<void(Session&)> on_transferring;
+    // The receiver's address changed from `previous`
+    std::function<void(Session&, const asio::ip::udp::endpoint& previous)>
+        on_moved;
+    // The session's coroutine ended, however it ended: done, refused,
+    // dropped by the receiver, idle or close()d by the owner. `completed`
+    // if the receiver acked the whole file.
+    std::function<void(Session&, bool completed)> on_closed;
+};
 
+// One receiver, served by a coroutine on the socket's executor: it waits
+// for a hello, then for the request, then sends the file stop-and-wait.
+// Every wait (the next datagram, the next batch, the receiver's silence)
+// is a co_await, so sessions cost a coroutine frame each rather than a
+// thread.
 class Session : public std::enable_shared_from_this<Session> {
    public:
-    Session(asio::ip::udp::socket& socket,
+    // A session that hears nothing for this long has lost its receiver
+    // (which gives up after MAX_RETRIES * RETRY_TIMEOUT_MS of silence).
+    static constexpr std::chrono::seconds IDLE_TIMEOUT{10};
+    // Datagrams queued beyond this are dropped; the receiver repeats
+    // itself.
+    static constexpr size_t MAX_INBOX = 64;
+
+    Session(Transport::Socket& socket,
             asio::ip::udp::endpoint remote_endpoint,
-            const std::string& file_path)
+            const SenderContext& context, uint64_t connection_id = 0)
         : m_socket(socket),
           m_remote_endpoint(remote_endpoint),
-          m_file_path(file_path) {}
+          m_context(context),
+          m_connection_id(connection_id),
+          m_wake(socket.get_executor()),
+          m_batch_wake(socket.get_executor()) {}
 
     void start() {
-        std::cout << "Session ready. Waiting for peer..." << std::endl;
+        std::cout << "Session ready for "
+                  << m_remote_endpoint.address().to_string() << ":"
+                  << m_remote_endpoint.port() << std::endl;
+        asio::co_spawn(
+            m_socket.get_executor(),
+            [self = shared_from_this()] { return self->run(); },
+            asio::detached);
+    }
+
+    // Queues a datagram for the coroutine. Called on the socket's thread.
+    void deliver(ReceiveBuffer::Ptr datagram) {
+        if (m_state == State::Closed || m_inbox_count == MAX_INBOX) return;
+        m_inbox[(m_inbox_head + m_inbox_count++) % MAX_INBOX] =
+            std::move(datagram);
+        m_wake.cancel();
     }
 
     bool is_closed() const { return m_state == State::Closed; }
 
-    void send_handshake_packet(const zapshare::v1::HandshakePacket& packet) {
-        std::string bytes;
-        if (!packet.SerializeToString(&bytes)) {
-            return;
+    // Ends the coroutine at its next wait. Also gives up the session's
+    // place in the fan-out cache, so a finished or dropped receiver stops
+    // pinning blocks.
+    void close() {
+        m_state = State::Closed;
+        while (m_inbox_count > 0) pop_inbox();
+        m_wake.cancel();
+        m_batch_wake.cancel();
+        if (m_cache_reader) {
+            m_served->cache->detach(*m_cache_reader);
+            m_cache_reader.reset();
         }
+    }
+    bool is_transferring() const { return m_state == State::Transferring; }
+    bool is_authenticated() const {
+        return m_state == State::Authenticated ||
+               m_state == State::Transferring;
+    }
 
-        m_socket.send_to(asio::buffer(bytes), m_remote_endpoint);
+    // Nonce of the hello that opened the session. A receiver sends the same
+    // hello to every sender candidate, so sessions sharing it belong to one
+    // receiver reaching us over several paths.
+    const std::string& hello_nonce() const { return m_hello_nonce; }
+
+    uint64_t connection_id() const { return m_connection_id; }
+    const asio::ip::udp::endpoint& remote_endpoint() const {
+        return m_remote_endpoint;
+    }
+
+   private:
+    // Bytes a packet advances the receiver's ack by, and whether it is the
+    // final DONE.
+    struct BatchSpan {
+        size_t length;
+        bool done;
+    };
+    struct SendBatch {
+        std::vector<zapshare::v1::ControlPacket> packets;
+        std::vector<std::string> datagrams;
+        std::vector<BatchSpan> spans;
+        std::vector<CryptoPipeline::SealJob> jobs;
+        bool ready = false;
+    };
+
+    asio::awaitable<void> run() {
+        // One co_await per statement: GCC 12 miscompiles co_await on both
+        // sides of &&.
+        bool serving = co_await handshake();
+        if (serving) serving = co_await await_request();
+        if (serving) co_await send_file();
+        if (m_timed_out) {
+            trace(Trace::Event::Timeout, 0);
+            std::cout << "Dropping idle session "
+                      << m_remote_endpoint.address().to_string() << ":"
+                      << m_remote_endpoint.port() << std::endl;
+        }
+        if (m_stats) m_stats->finished = true;
+        close();
+        if (m_context.on_closed) m_context.on_closed(*this, m_completed);
+    }
+
+    // Timer as condition variable: sleeps on `timer` until `ready()` holds,
+    // `deadline` passes or the session closes. Whatever makes `ready()`
+    // true cancels the timer. Returns whether it is ready and still open.
+    template <typename Ready>
+    asio::awaitable<bool> wait_until(
+        Transport::Timer& timer, Ready ready,
+        Transport::Clock::time_point deadline =
+            Transport::Clock::time_point::max()) {
+        while (!is_closed() && !ready()) {
+            if (Transport::Clock::now() >= deadline) co_return false;
+            timer.expires_at(deadline);
+            asio::error_code ec;
+            co_await timer.async_wait(
+                asio::redirect_error(asio::use_awaitable, ec));
+        }
+        co_return !is_closed();
+    }
+
+    ReceiveBuffer::Ptr pop_inbox() {
+        ReceiveBuffer::Ptr datagram = std::move(m_inbox[m_inbox_head]);
+        m_inbox_head = (m_inbox_head + 1) % MAX_INBOX;
+        --m_inbox_count;
+        return datagram;
+    }
+
+    // Null once the session closes or has heard nothing for IDLE_TIMEOUT.
+    asio::awaitable<ReceiveBuffer::Ptr> next_datagram() {
+        if (!co_await wait_until(
+                m_wake, [this] { return m_inbox_count > 0; },
+                m_last_activity + IDLE_TIMEOUT)) {
+            m_timed_out = !is_closed();
+            co_return ReceiveBuffer::Ptr();
+        }
+        m_last_activity = Transport::Clock::now();
+        co_return pop_inbox();
+    }
+
+    // Waits for a hello that checks out. A resumed session comes out of it
+    // already transferring.
+    asio::awaitable<bool> handshake() {
+        while (m_state == State::WaitingHello) {
+            ReceiveBuffer::Ptr datagram = co_await next_datagram();
+            if (!datagram) co_return false;
+            m_remote_endpoint = datagram->sender;
+            handle_handshake_packet(datagram->view());
+        }
+        if (!is_closed() && m_context.on_authenticated) {
+            m_context.on_authenticated(*this);
+        }
+        co_return !is_closed();
+    }
+
+    // Answers repeats of the hello until the receiver asks for the file.
+    asio::awaitable<bool> await_request() {
+        while (m_state == State::Authenticated) {
+            ReceiveBuffer::Ptr datagram = co_await next_datagram();
+            if (!datagram) co_return false;
+            if (resend_server_hello(datagram->view())) continue;
+
+            if (!decode_control(*datagram, &m_control)) continue;
+            if (m_control.has_get()) {
+                begin_transfer();
+            } else if (m_control.has_error()) {
+                close();
+            }
+        }
+        if (!is_closed() && m_context.on_transferring) {
+            m_context.on_transferring(*this);
+        }
+        co_return !is_closed();
+    }
+
+    // Stop-and-wait: each packet goes out once the receiver has acked the
+    // one before it.
+    asio::awaitable<void> send_file() {
+        for (;;) {
+            if (!co_await next_packet()) co_return;
+            const BatchSpan& span = current_batch().spans[m_send_pos];
+            send_message(current_batch().datagrams[m_send_pos]);
+            m_sent_at = Transport::Clock::now();
+            m_resent = false;
+            m_stats->packets.add();
+            trace(Trace::Event::PacketSent, m_offset,
+                  static_cast<uint32_t>(span.length));
+            if (span.done) {
+                std::cout << "Sent DONE." << std::endl;
+            }
+            if (!co_await await_ack(m_offset + span.length, span.done)) {
+                co_return;
+            }
+            // Karn: a resent packet's ack may answer either copy
+            if (!m_resent) {
+                const auto rtt = m_last_activity - m_sent_at;
+                m_stats->add_rtt(rtt);
+                trace(Trace::Event::RttSample, Trace::to_micros(rtt));
+            }
+            m_stats->bytes.add(span.length);
+
+            if (span.done) {
+                std::cout << "Final ACK received. Transfer complete"
+                          << std::endl;
+                ++m_served->receivers_completed;
+                m_completed = true;
+                co_return;
+            }
+            m_offset += span.length;
+            ++m_send_pos;
+        }
     }
 
-    void send_control_packet(const zapshare::v1::ControlPacket packet) {
+    // Moves on to the next batch once the current one is spent, waiting
+    // for it if it is still being read or sealed. Keeps the batch after
+    // that in preparation.
+    asio::awaitable<bool> next_packet() {
+        if (m_send_pos >= current_batch().spans.size()) {
+            if (!next_batch().ready && !m_preparing) prepare_next_batch();
+            if (!co_await wait_until(m_wake,
+                                     [this] { return next_batch().ready; })) {
+                co_return false;
+            }
+            current_batch().ready = false;
+            m_current_batch ^= 1;
+            m_send_pos = 0;
+        }
+        if (!m_read_done && !m_preparing && !next_batch().ready) {
+            prepare_next_batch();
+        }
+        m_stats->queue_depth.set(
+            current_batch().spans.size() - m_send_pos - 1 +
+            (next_batch().ready ? next_batch().spans.size() : 0));
+        co_return true;
+    }
+
+    // Waits until the receiver acks `expected`, resending the packet in
+    // flight whenever it repeats its previous ack or its request. DONE
+    // advances no offset, so only an ack marked complete answers it.
+    asio::awaitable<bool> await_ack(size_t expected, bool done) {
+        for (;;) {
+            ReceiveBuffer::Ptr datagram = co_await next_datagram();
+            if (!datagram) co_return false;
+
+            if (!decode_control(*datagram, &m_control)) {
+                // Off the hot path: only undecodable datagrams get here
+                if (is_repeated_resume(datagram->view())) {
+                    resend_current_chunk();
+                }
+                continue;
+            }
+            if (m_control.has_ack()) {
+                const size_t ack_offset =
+                    static_cast<size_t>(m_control.ack().next_offset());
+                trace(Trace::Event::AckReceived, ack_offset,
+                      m_control.ack().complete());
+                if (ack_offset == expected &&
+                    m_control.ack().complete() == done) {
+                    co_return true;
+                }
+                if (ack_offset == m_offset) resend_current_chunk();
+            } else if (m_control.has_get()) {
+                resend_current_chunk();
+            } else if (m_control.has_error()) {
+                close();
+                co_return false;
+            }
+        }
+    }
+
+    void send_handshake_packet(const zapshare::v1::HandshakePacket& packet) {
         std::string bytes;
         if (!packet.SerializeToString(&bytes)) {
             return;
@@ -76,21 +384,16 @@ class Session : public std::enable_shared_from_this<Session> {
         send_handshake_packet(packet);
     }
 
-    void send_control_error(const std::string& transfer_id,
-                            zapshare::v1::ErrorCode code,
-                            const std::string& message) {
-        zapshare::v1::ControlPacket packet;
-        auto* error = packet.mutable_error();
-        error->set_transfer_id(transfer_id);
-        error->set_code(code);
-        error->set_message(message);
-        send_control_packet(packet);
-    }
-
-    void handle_handshake_packet(const std::string& data) {
+    void handle_handshake_packet(std::string_view data) {
         zapshare::v1::HandshakePacket packet;
 
-        if (!packet.ParseFromString(data)) {
+        if (!packet.ParseFromArray(data.data(),
+                                   static_cast<int>(data.size()))) {
+            return;
+        }
+
+        if (packet.has_resume_hello()) {
+            handle_resume_hello(packet.resume_hello());
             return;
         }
 
@@ -105,205 +408,450 @@ class Session : public std::enable_shared_from_this<Session> {
         if (hello.version() != zapshare::v1::PROTOCOL_VERSION_1) {
             send_handshake_error(zapshare::v1::ERROR_CODE_BAD_PACKET,
                                  "Unsupported protocol version");
-            m_state = State::Closed;
+            close();
+            return;
+        }
+
+        if (!Handshake::verify_client_hello(hello)) {
+            send_handshake_error(zapshare::v1::ERROR_CODE_HANDSHAKE_FAILED,
+                                 "Bad receiver signature");
+            close();
             return;
         }
 
         if (hello.token().empty()) {
             send_handshake_error(zapshare::v1::ERROR_CODE_INVALID_TOKEN,
                                  "Missing Token!");
-            m_state = State::Closed;
+            close();
+            return;
+        }
+
+        m_served = find_transfer(hello.transfer_id());
+        if (!m_served) {
+            send_handshake_error(zapshare::v1::ERROR_CODE_TRANSFER_NOT_FOUND,
+                                 "Unknown transfer");
+            close();
             return;
         }
 
         if (!validate_token(hello.token())) {
             send_handshake_error(zapshare::v1::ERROR_CODE_INVALID_TOKEN,
                                  "Invalid Token");
-            m_state = State::Closed;
+            close();
             return;
         }
 
-        m_state = State::Authenticated;
         zapshare::v1::HandshakePacket response;
         auto* server_hello = response.mutable_server_hello();
         server_hello->set_version(zapshare::v1::PROTOCOL_VERSION_1);
         server_hello->set_transfer_id(hello.transfer_id());
 
-        // TODO: need to complete
-        IdentityKeyPair server_identity = generate_identity_keypair();
-        EphemeralKeyPair server_ephemeral = generate_ephemeral_keypair();
+        const IdentityKeyPair& server_identity = Keys::identity();
+        const EphemeralKeyPair server_ephemeral = Keys::take_ephemeral();
         std::string server_nonce = random_nonce(32);
         server_hello->set_sender_nonce(server_nonce);
         auto* identity = server_hello->mutable_sender_identity();
         identity->set_ephemeral_public_key(server_ephemeral.public_key);
         identity->set_long_term_public_key(server_identity.public_key);
 
-        server_hello->set_sender_signature(
-            sign_server_hello(*server_hello, server_identity));
-
-        send_handshake_packet(response);
-    }
-
-    void handle_get_request(const zapshare::v1::GetRequest& get) {
-        if (m_state == State::Authenticated) {
-            m_file_id = m_transfer_metadata.id.empty()
-                            ? m_transfer_metadata.file_name
-                            : m_transfer_metadata.id;
-            m_file = std::ifstream(m_file_path, std::ifstream::binary);
-            if (!m_file.is_open()) {
-                send_control_error(get.transfer_id(),
-                                   zapshare::v1::ERROR_CODE_TRANSFER_NOT_FOUND,
-                                   "Failed to open file");
-                m_state = State::Closed;
+        if (hello.secure_transport()) {
+            const zapshare::v1::CipherSuite suite =
+                Handshake::select_cipher_suite(hello);
+            if (suite == zapshare::v1::CIPHER_SUITE_UNSPECIFIED) {
+                send_handshake_error(zapshare::v1::ERROR_CODE_HANDSHAKE_FAILED,
+                                     "No common cipher suite");
+                close();
                 return;
             }
-            std::cout << "Starting the UDP transfer...." << std::endl;
-            m_state = State::Transferring;
-            send_next_chunk();
-            return;
+            try {
+                const SessionKeys keys = derive_server_keys(
+                    server_ephemeral,
+                    hello.receiver_identity().ephemeral_public_key());
+                m_channel = SecureChannel(keys, hello.transfer_id(),
+                                          Handshake::to_aead_cipher(suite));
+                if (m_context.tickets) {
+                    server_hello->set_resumption_ticket(
+                        m_context.tickets->issue(
+                            hello.transfer_id(),
+                            derive_resumption_secret(keys, false), suite));
+                    server_hello->set_ticket_lifetime(
+                        Resumption::TICKET_LIFETIME_SECS);
+                }
+            } catch (const std::exception& e) {
+                send_handshake_error(zapshare::v1::ERROR_CODE_HANDSHAKE_FAILED,
+                                     e.what());
+                close();
+                return;
+            }
+            server_hello->set_secure_transport(true);
+            server_hello->set_cipher_suite(suite);
+            server_hello->set_connection_id(m_connection_id);
         }
 
-        if (m_state == State::Transferring) {
-            resend_current_chunk();
+        server_hello->set_sender_signature(
+            Handshake::sign_server_hello(*server_hello, server_identity));
+
+        m_transfer_id = hello.transfer_id();
+        m_hello_nonce = hello.receiver_nonce();
+        m_state = State::Authenticated;
+        if (!response.SerializeToString(&m_server_hello_bytes)) {
             return;
         }
+        send_message(m_server_hello_bytes);
     }
 
-    void handle_ack(const zapshare::v1::Ack& ack) {
-        if (m_state != State::Transferring) {
+    // 0-RTT: a valid ticket stands in for the token check and the key
+    // exchange, and the early data carries the first request, so the
+    // session goes straight to sending. A rejected ticket leaves the
+    // session waiting for the full ClientHello the receiver falls back to.
+    void handle_resume_hello(const zapshare::v1::ResumeHello& hello) {
+        if (hello.version() != zapshare::v1::PROTOCOL_VERSION_1) {
+            send_handshake_error(zapshare::v1::ERROR_CODE_BAD_PACKET,
+                                 "Unsupported protocol version");
             return;
         }
 
-        size_t ack_offset = static_cast<size_t>(ack.next_offset());
-        size_t expected_offset = m_offset + m_last_chunk_size;
-
-        if (ack_offset == expected_offset) {
-            if (m_last_chunk_done) {
-                std::cout << "Final ACK received. Transfer complete"
-                          << std::endl;
-                m_state = State::Closed;
-            } else {
-                m_offset = expected_offset;
-                send_next_chunk();
-            }
-        } else if (ack_offset == m_offset) {
-            resend_current_chunk();
+        std::shared_ptr<ServedFile> served = find_transfer(hello.transfer_id());
+        std::optional<zapshare::v1::ResumptionTicket> ticket;
+        if (served && m_context.tickets) {
+            ticket = m_context.tickets->redeem(hello, served->transfer.id);
         }
-    }
-
-    void handle_control_packet(const std::string& data) {
-        zapshare::v1::ControlPacket packet;
-
-        if (!packet.ParseFromString(data)) {
+        if (!ticket) {
+            send_handshake_error(zapshare::v1::ERROR_CODE_HANDSHAKE_FAILED,
+                                 "Resumption rejected");
             return;
         }
 
-        if (packet.has_get()) {
-            handle_get_request(packet.get());
+        zapshare::v1::ControlPacket request;
+        try {
+            m_channel = SecureChannel(
+                derive_resumption_keys(ticket->resumption_secret(),
+                                       hello.receiver_nonce(), false),
+                hello.transfer_id(),
+                Handshake::to_aead_cipher(ticket->cipher_suite()));
+        } catch (const std::exception& e) {
+            send_handshake_error(zapshare::v1::ERROR_CODE_HANDSHAKE_FAILED,
+                                 e.what());
             return;
         }
-
-        if (packet.has_ack()) {
-            handle_ack(packet.ack());
+        if (!m_channel.decode(hello.early_data().data(),
+                              hello.early_data().size(), &request) ||
+            !request.has_get()) {
+            m_channel = SecureChannel();
+            send_handshake_error(zapshare::v1::ERROR_CODE_BAD_PACKET,
+                                 "Bad early data");
             return;
         }
 
-        if (packet.has_error()) {
-            m_state = State::Closed;
-            return;
+        std::cout << "Session resumed from ticket." << std::endl;
+        m_transfer_id = hello.transfer_id();
+        m_served = std::move(served);
+        m_transfer_metadata = m_served->transfer;
+        m_resume_nonce = hello.receiver_nonce();
+        m_hello_nonce = hello.receiver_nonce();
+        begin_transfer();
+    }
+
+    // The receiver repeats its ResumeHello until data arrives. Its nonce is
+    // spent, so a repeat stands for the GetRequest it carries.
+    bool is_repeated_resume(std::string_view data) const {
+        zapshare::v1::HandshakePacket packet;
+        return !m_resume_nonce.empty() &&
+               packet.ParseFromArray(data.data(),
+                                     static_cast<int>(data.size())) &&
+               packet.has_resume_hello() &&
+               packet.resume_hello().receiver_nonce() == m_resume_nonce;
+    }
+
+    // A lost ServerHello makes the receiver repeat its ClientHello after we
+    // have already moved on; answer it again instead of treating it as a
+    // control packet.
+    bool resend_server_hello(std::string_view data) {
+        zapshare::v1::HandshakePacket packet;
+        if (!packet.ParseFromArray(data.data(),
+                                   static_cast<int>(data.size())) ||
+            !packet.has_client_hello() ||
+            packet.client_hello().transfer_id() != m_transfer_id) {
+            return false;
         }
+        send_message(m_server_hello_bytes);
+        return true;
     }
 
-    void handle_packet(const std::string& data,
-                       const asio::ip::udp::endpoint& sender) {
-        if (m_state == State::Closed) return;
+    void begin_transfer() {
+        m_extent_index = 0;
+        if (m_served->cache) m_cache_reader = m_served->cache->attach();
+        ++m_served->receivers_started;
+        if (m_channel.is_secure()) {
+            std::cout << "Secure transport enabled ("
+                      << Handshake::cipher_name(m_channel.cipher()) << ")."
+                      << std::endl;
+        }
+        std::cout << "Starting the UDP transfer...." << std::endl;
+        m_state = State::Transferring;
+
+        m_stats = std::make_shared<Telemetry::TransferStats>();
+        if (m_context.sampler) {
+            m_context.sampler->track(
+                m_remote_endpoint.address().to_string() + ":" +
+                    std::to_string(m_remote_endpoint.port()),
+                m_stats);
+        }
+    }
 
-        if (m_state == State::WaitingHello) {
-            m_remote_endpoint = sender;
-            handle_handshake_packet(data);
-            return;
+    bool decode_control(const ReceiveBuffer& datagram,
+                        zapshare::v1::ControlPacket* packet) {
+        const std::string_view data = datagram.view();
+        if (!m_channel.decode(data.data(), data.size(), packet)) {
+            return false;
         }
 
-        if (m_state == State::Authenticated || m_state == State::Transferring) {
-            handle_control_packet(data);
-            return;
+        // The receiver's address changed (NAT rebinding, new interface) and
+        // its connection ID led the packet here. Only an authenticated
+        // packet may move the session.
+        if (datagram.sender != m_remote_endpoint && m_channel.is_secure()) {
+            std::cout << "Session moved to "
+                      << datagram.sender.address().to_string() << ":"
+                      << datagram.sender.port() << std::endl;
+            const asio::ip::udp::endpoint previous =
+                std::exchange(m_remote_endpoint, datagram.sender);
+            if (m_context.on_moved) m_context.on_moved(*this, previous);
         }
+        return true;
     }
 
-   private:
     void send_message(const std::string& msg) {
         m_socket.send_to(asio::buffer(msg), m_remote_endpoint);
     }
 
     void resend_current_chunk() {
-        if (m_last_packet_cache.empty()) {
-            send_next_chunk();
-        } else {
-            m_socket.send_to(asio::buffer(m_last_packet_cache),
-                             m_remote_endpoint);
-        }
-    }
-
-    void send_next_chunk() {
-        if (!m_file.is_open()) return;
-
-        m_file.seekg(m_offset);  // Ensure we read from correct offset
-        m_file.read(m_chunk_buffer.data(), UdpConfig::PAYLOAD_SIZE);
-        std::streamsize bytes_read = m_file.gcount();
-
-        if (bytes_read <= 0) {
-            zapshare::v1::ControlPacket done_packet;
-            auto* done = done_packet.mutable_done();
-            done->set_transfer_id(m_transfer_metadata.id);
-            done->set_final_size(m_transfer_metadata.file_size);
-            done->set_file_hash(m_transfer_metadata.file_hash);
-            std::string bytes;
-            done_packet.SerializeToString(&bytes);
-            send_message(bytes);
-            m_last_packet_cache = bytes;
-            m_last_chunk_done = true;
-            m_last_chunk_size = 0;
-            std::cout << "Sent DONE." << std::endl;
+        SendBatch& batch = current_batch();
+        // Sealed datagrams carry a sequence number the receiver has already
+        // consumed, so a retransmission is sealed again under a new one.
+        if (m_channel.is_secure() &&
+            !m_channel.encode(batch.packets[m_send_pos],
+                              &batch.datagrams[m_send_pos])) {
             return;
         }
+        send_message(batch.datagrams[m_send_pos]);
+        m_stats->retransmits.add();
+        m_resent = true;
+        trace(Trace::Event::PacketResent, m_offset);
+    }
 
-        m_last_chunk_size = bytes_read;
-        m_last_chunk_done = false;
+    void trace(Trace::Event event, uint64_t value, uint32_t extra = 0) const {
+        Trace::record(event, Trace::Role::Sender, m_connection_id, value,
+                      extra);
+    }
 
-        zapshare::v1::ControlPacket data_packet;
-        auto* data = data_packet.mutable_data();
-        data->set_transfer_id(m_transfer_metadata.id);
-        data->set_offset(m_offset);
-        data->set_payload(m_chunk_buffer.data(),
-                          static_cast<size_t>(bytes_read));
+    // Returns the extent containing `offset`, or nullptr past the last one.
+    // The read cursor only moves forward, so this never has to rewind.
+    const Sparse::Extent* extent_at(uint64_t offset) {
+        const auto& extents = m_served->file->extents();
+        while (m_extent_index < extents.size() &&
+               extents[m_extent_index].end() <= offset) {
+            ++m_extent_index;
+        }
+        return m_extent_index < extents.size() ? &extents[m_extent_index]
+                                               : nullptr;
+    }
 
-        std::string bytes;
-        data_packet.SerializeToString(&bytes);
+    SendBatch& current_batch() { return m_batches[m_current_batch]; }
+    SendBatch& next_batch() { return m_batches[m_current_batch ^ 1]; }
 
-        m_last_packet_cache = bytes;  // Cache for retransmission
-        m_socket.send_to(asio::buffer(bytes), m_remote_endpoint);
+    ssize_t read_file(uint64_t offset, char* buffer, size_t length) {
+        if (m_cache_reader) {
+            return m_served->cache->read(*m_cache_reader, offset, buffer,
+                                         length);
+        }
+        return m_served->file->read_at(offset, buffer, length);
+    }
+
+    // Reads ahead up to SEAL_BATCH packets worth of the file into `batch`.
+    // Packet messages are reused between batches to keep their payload
+    // buffers. Returns false if nothing could be read because the fan-out
+    // cache has yet to load the next block.
+    bool read_batch(SendBatch& batch) {
+        if (batch.packets.size() < UdpConfig::SEAL_BATCH) {
+            batch.packets.resize(UdpConfig::SEAL_BATCH);
+        }
+        batch.spans.clear();
+        batch.ready = false;
+
+        uint64_t cursor = m_read_offset;
+        while (batch.spans.size() < UdpConfig::SEAL_BATCH) {
+            // Not cleared: setting a different body drops the old one, and
+            // every field of the new body is set below.
+            auto& packet = batch.packets[batch.spans.size()];
+
+            size_t chunk_limit = UdpConfig::PAYLOAD_SIZE;
+            if (const Sparse::Extent* extent = extent_at(cursor)) {
+                if (extent->hole) {
+                    auto* hole = packet.mutable_hole();
+                    hole->set_transfer_id(m_transfer_metadata.id);
+                    hole->set_offset(cursor);
+                    hole->set_length(extent->end() - cursor);
+                    batch.spans.push_back(
+                        {static_cast<size_t>(extent->end() - cursor), false});
+                    cursor = extent->end();
+                    continue;
+                }
+                // Never read across into the next hole
+                chunk_limit = static_cast<size_t>(
+                    std::min<uint64_t>(chunk_limit, extent->end() - cursor));
+            }
+
+            auto* data = packet.mutable_data();
+            std::string* payload = data->mutable_payload();
+            payload->resize(chunk_limit);
+            const ssize_t bytes_read =
+                read_file(cursor, payload->data(), chunk_limit);
+            if (bytes_read == ChunkCache::PENDING) {
+                packet.Clear();
+                break;
+            }
+
+            if (bytes_read <= 0) {
+                auto* done = packet.mutable_done();
+                done->set_transfer_id(m_transfer_metadata.id);
+                done->set_final_size(m_transfer_metadata.file_size);
+                done->set_file_hash(m_transfer_metadata.file_hash);
+                batch.spans.push_back({0, true});
+                m_read_done = true;
+                break;
+            }
+
+            payload->resize(static_cast<size_t>(bytes_read));
+            data->set_transfer_id(m_transfer_metadata.id);
+            data->set_offset(cursor);
+            batch.spans.push_back({static_cast<size_t>(bytes_read), false});
+            cursor += static_cast<uint64_t>(bytes_read);
+        }
+        m_read_offset = cursor;
+        return !batch.spans.empty();
+    }
+
+    void prepare_next_batch() {
+        m_preparing = true;
+        asio::co_spawn(
+            m_socket.get_executor(),
+            [self = shared_from_this(), &batch = next_batch()] {
+                return self->prepare_batch(batch);
+            },
+            asio::detached);
     }
 
+    // Reads `batch` and seals it, on the crypto workers when there are
+    // any. Runs alongside the send loop, so by the time the current batch
+    // drains the next one is usually ready. The completions it waits on
+    // hold the session and only touch its members, so giving up halfway
+    // on close is safe.
+    asio::awaitable<void> prepare_batch(SendBatch& batch) {
+        while (!read_batch(batch)) {
+            // Fan-out cache miss: park until the read-ahead catches up
+            m_block_loaded = false;
+            m_served->cache->when_ready(
+                m_read_offset, m_socket.get_executor(),
+                [self = shared_from_this()] {
+                    self->m_block_loaded = true;
+                    self->m_batch_wake.cancel();
+                });
+            if (!co_await wait_until(m_batch_wake,
+                                     [this] { return m_block_loaded; })) {
+                co_return;
+            }
+        }
+        const auto packets = std::span(batch.packets).first(batch.spans.size());
+
+        CryptoPipeline* pipeline = m_context.pipeline;
+        if (!pipeline || pipeline->thread_count() == 0 ||
+            !m_channel.is_secure()) {
+            m_channel.encode_batch(packets, &batch.datagrams);
+        } else {
+            batch.datagrams.resize(packets.size());
+            batch.jobs.resize(packets.size());
+            for (size_t i = 0; i < packets.size(); ++i) {
+                batch.jobs[i] = {&packets[i], m_channel.next_sequence(),
+                                 &batch.datagrams[i], false};
+            }
+            m_sealed = false;
+            pipeline->seal_batch(m_channel, batch.jobs,
+                                 [self = shared_from_this()] {
+                                     self->m_sealed = true;
+                                     self->m_batch_wake.cancel();
+                                 });
+            if (!co_await wait_until(m_batch_wake,
+                                     [this] { return m_sealed; })) {
+                co_return;
+            }
+        }
+        m_preparing = false;
+        batch.ready = true;
+        m_wake.cancel();
+    }
+
+    // The token is the transfer's secret, so it is checked against our own
+    // record instead of costing a rendezvous round trip per hello.
     bool validate_token(const std::string& token) {
-        try {
-            m_transfer_metadata = Utils::get_transfer_metadata(token);
-            return true;
-        } catch (...) {
+        const std::string& expected = m_served->transfer.token;
+        if (token.size() != expected.size() ||
+            CRYPTO_memcmp(token.data(), expected.data(), token.size()) != 0) {
             return false;
         }
+        m_transfer_metadata = m_served->transfer;
+        return true;
+    }
+
+    std::shared_ptr<ServedFile> find_transfer(const std::string& id) const {
+        return m_context.find_transfer ? m_context.find_transfer(id) : nullptr;
     }
 
    private:
-    asio::ip::udp::socket& m_socket;
+    Transport::Socket& m_socket;
     asio::ip::udp::endpoint m_remote_endpoint;
-    std::string m_file_path;
+    const SenderContext& m_context;
+    const uint64_t m_connection_id;
     State m_state = State::WaitingHello;
-    std::ifstream m_file;
-    std::string m_file_id;
-    std::array<char, UdpConfig::MAX_PACKET_SIZE> m_chunk_buffer;
+    Transport::Clock::time_point m_last_activity = Transport::Clock::now();
+    bool m_timed_out = false;
+    // The receiver acked DONE
+    bool m_completed = false;
+    std::string m_transfer_id;
+    std::string m_server_hello_bytes;
+    std::string m_resume_nonce;
+    std::string m_hello_nonce;
+    SecureChannel m_channel;
+    // Every control packet from the receiver is decoded into this one, so
+    // a run of acks reuses its body instead of allocating one per ack.
+    zapshare::v1::ControlPacket m_control;
+    // Offset of the packet in flight, when it was first sent and whether
+    // it has been sent again since
     size_t m_offset = 0;
-    size_t m_last_chunk_size = 0;
-    bool m_last_chunk_done = false;
-    std::string m_last_packet_cache;
+    Transport::Clock::time_point m_sent_at;
+    bool m_resent = false;
+    std::shared_ptr<Telemetry::TransferStats> m_stats;
+    size_t m_extent_index = 0;
+
+    // Datagrams waiting for the coroutine, which sleeps on m_wake. A ring,
+    // so queueing never allocates.
+    std::array<ReceiveBuffer::Ptr, MAX_INBOX> m_inbox;
+    size_t m_inbox_head = 0;
+    size_t m_inbox_count = 0;
+    Transport::Timer m_wake;
+
+    std::shared_ptr<ServedFile> m_served;
+    std::optional<ChunkCache::ReaderId> m_cache_reader;
+
+    // Double buffered: one batch is sent while the other is read and
+    // sealed by prepare_batch(), which sleeps on m_batch_wake.
+    SendBatch m_batches[2];
+    size_t m_current_batch = 0;
+    size_t m_send_pos = 0;
+    uint64_t m_read_offset = 0;
+    bool m_read_done = false;
+    bool m_preparing = false;
+    Transport::Timer m_batch_wake;
+    bool m_block_loaded = false;
+    bool m_sealed = false;
     TRANSFERS m_transfer_metadata{};
 };
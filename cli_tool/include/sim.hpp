@@ -0,0 +1,344 @@
+// Discrete-event simulation: a virtual clock and an in-memory network for
+// the transport to run on in place of the real ones. Built only with
+// ZAPSHARE_SIMULATION, which makes transport.hpp hand Session and the
+// receive loop Sim::Clock, Sim::Timer and Sim::Socket.
+//
+// Everything runs on one io_context on one thread. Sim::run() polls it
+// until no handler is ready, then jumps the clock straight to the next
+// timer expiry (the network's deliveries are timers too), so idle time
+// costs nothing: a 200 ms retry timeout takes as long as the handlers it
+// wakes. With nothing but the seeded Netsim links to decide what happens,
+// the same scenario always plays out the same way.
+#pragma once
+
+#ifndef ZAPSHARE_SIMULATION
+#error "sim.hpp is for ZAPSHARE_SIMULATION builds only"
+#endif
+
+#include <algorithm>
+#include <array>
+#include <asio.hpp>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <queue>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "netsim.hpp"
+
+namespace Sim {
+
+// Virtual time. Shares steady_clock's time_point type, so the transport's
+// time_point members work unchanged on either clock.
+class Clock {
+   public:
+    using duration = std::chrono::steady_clock::duration;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::steady_clock::time_point;
+    static constexpr bool is_steady = true;
+
+    // Starts well clear of time_point{}, which the transport reads as
+    // "never"
+    static constexpr time_point START{std::chrono::hours(1)};
+
+    static time_point now() noexcept { return s_now; }
+    static void reset() { s_now = START; }
+    static void advance_to(time_point when) { s_now = std::max(s_now, when); }
+
+   private:
+    static inline time_point s_now = START;
+};
+
+// Asks the reactor to look at the timers again straight away: whether one
+// is due depends on Clock::now(), which only Sim::run() moves.
+struct WaitTraits {
+    static Clock::duration to_wait_duration(const Clock::duration&) {
+        return Clock::duration::zero();
+    }
+    static Clock::duration to_wait_duration(const Clock::time_point&) {
+        return Clock::duration::zero();
+    }
+};
+
+class Timer;
+
+// Every live timer, for Sim::run() to find the next expiry
+inline std::set<const Timer*>& timers() {
+    static std::set<const Timer*> registry;
+    return registry;
+}
+
+class Timer : public asio::basic_waitable_timer<Clock, WaitTraits> {
+   public:
+    template <typename ExecutionContextOrExecutor>
+    explicit Timer(ExecutionContextOrExecutor&& context)
+        : basic_waitable_timer(
+              std::forward<ExecutionContextOrExecutor>(context)) {
+        timers().insert(this);
+    }
+    ~Timer() { timers().erase(this); }
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+};
+
+// The earliest expiry still ahead of now; max() when there is none. A
+// timer nobody waits on may be counted, which only costs a wasted step.
+inline Clock::time_point next_expiry() {
+    Clock::time_point next = Clock::time_point::max();
+    for (const Timer* timer : timers()) {
+        const Clock::time_point expiry = timer->expiry();
+        if (expiry > Clock::now()) next = std::min(next, expiry);
+    }
+    return next;
+}
+
+// Runs `io` until `done()` holds. Returns false if it never does: nothing
+// left to happen (a deadlock), or the clock would pass `until`.
+template <typename Done>
+bool run(asio::io_context& io, Done done,
+         Clock::time_point until = Clock::time_point::max()) {
+    for (;;) {
+        io.restart();
+        while (io.poll() > 0) {
+            if (done()) return true;
+        }
+        if (done()) return true;
+        const Clock::time_point next = next_expiry();
+        if (next == Clock::time_point::max() || next > until) return false;
+        Clock::advance_to(next);
+    }
+}
+
+class Socket;
+
+// Datagrams between Sockets, each ordered pair of endpoints over its own
+// Netsim::Link. Links are made on first use from `impairment`, the seed
+// moved on for each so that no two lose packets in step.
+class Network {
+   public:
+    Network(asio::io_context& io, const Netsim::Impairment& impairment)
+        : m_io(io), m_impairment(impairment), m_timer(io) {}
+
+    // Overrides the impairment from `from` to `to`; call before traffic
+    void set_link(const asio::ip::udp::endpoint& from,
+                  const asio::ip::udp::endpoint& to,
+                  const Netsim::Impairment& impairment) {
+        m_links.erase({from, to});
+        m_links.emplace(std::pair(from, to), impairment);
+    }
+
+    const Netsim::Link* link(const asio::ip::udp::endpoint& from,
+                             const asio::ip::udp::endpoint& to) const {
+        auto it = m_links.find({from, to});
+        return it == m_links.end() ? nullptr : &it->second;
+    }
+
+    asio::io_context& io() { return m_io; }
+
+   private:
+    friend class Socket;
+
+    struct InFlight {
+        Clock::time_point arrive_at;
+        uint64_t order;
+        std::shared_ptr<const std::string> data;
+        asio::ip::udp::endpoint from;
+        asio::ip::udp::endpoint to;
+
+        bool operator>(const InFlight& other) const {
+            return arrive_at != other.arrive_at ? arrive_at > other.arrive_at
+                                                : order > other.order;
+        }
+    };
+
+    void attach(Socket& socket, const asio::ip::udp::endpoint& endpoint) {
+        m_sockets[endpoint] = &socket;
+    }
+    void detach(const asio::ip::udp::endpoint& endpoint) {
+        m_sockets.erase(endpoint);
+    }
+
+    Netsim::Link& link_for(const asio::ip::udp::endpoint& from,
+                           const asio::ip::udp::endpoint& to) {
+        auto it = m_links.find({from, to});
+        if (it == m_links.end()) {
+            Netsim::Impairment impairment = m_impairment;
+            impairment.seed += m_links.size();
+            it = m_links.emplace(std::pair(from, to), impairment).first;
+        }
+        return it->second;
+    }
+
+    void send(const asio::ip::udp::endpoint& from,
+              const asio::ip::udp::endpoint& to, const char* data,
+              size_t size) {
+        const Netsim::Fate fate =
+            link_for(from, to).transmit(Clock::now(), size);
+        if (fate.copies == 0) return;
+        auto bytes = std::make_shared<const std::string>(data, size);
+        for (size_t i = 0; i < fate.copies; ++i) {
+            m_in_flight.push({fate.arrive_at[i], m_sent++, bytes, from, to});
+        }
+        schedule();
+    }
+
+    void schedule() {
+        if (m_in_flight.empty()) return;
+        const Clock::time_point next = m_in_flight.top().arrive_at;
+        if (m_timer_armed && next >= m_timer.expiry()) return;
+        m_timer_armed = true;
+        m_timer.expires_at(next);
+        m_timer.async_wait([this](asio::error_code ec) {
+            if (ec) return;
+            m_timer_armed = false;
+            deliver_due();
+        });
+    }
+
+    void deliver_due();
+
+    asio::io_context& m_io;
+    const Netsim::Impairment m_impairment;
+    std::map<asio::ip::udp::endpoint, Socket*> m_sockets;
+    std::map<std::pair<asio::ip::udp::endpoint, asio::ip::udp::endpoint>,
+             Netsim::Link>
+        m_links;
+    Timer m_timer;
+    bool m_timer_armed = false;
+    std::priority_queue<InFlight, std::vector<InFlight>, std::greater<>>
+        m_in_flight;
+    uint64_t m_sent = 0;
+};
+
+// The part of asio::ip::udp::socket the transport uses, bound to an
+// address on a Network
+class Socket {
+   public:
+    using executor_type = asio::io_context::executor_type;
+
+    // Datagrams waiting beyond this are dropped, as by a full socket buffer
+    static constexpr size_t MAX_QUEUED = 256;
+
+    Socket(Network& network, const asio::ip::udp::endpoint& endpoint)
+        : m_network(network), m_endpoint(endpoint) {
+        m_network.attach(*this, m_endpoint);
+    }
+    ~Socket() { m_network.detach(m_endpoint); }
+
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+
+    executor_type get_executor() { return m_network.io().get_executor(); }
+    asio::ip::udp::endpoint local_endpoint() const { return m_endpoint; }
+
+    template <typename ConstBuffer>
+    size_t send_to(const ConstBuffer& buffer,
+                   const asio::ip::udp::endpoint& to) {
+        m_network.send(m_endpoint, to, static_cast<const char*>(buffer.data()),
+                       buffer.size());
+        return buffer.size();
+    }
+    template <typename ConstBuffer>
+    size_t send_to(const ConstBuffer& buffer, const asio::ip::udp::endpoint& to,
+                   int, asio::error_code& ec) {
+        ec = {};
+        return send_to(buffer, to);
+    }
+
+    // `handler(error_code, size_t)` runs from the io_context, never inline
+    void async_receive_from(
+        asio::mutable_buffer buffer, asio::ip::udp::endpoint& sender,
+        std::function<void(asio::error_code, size_t)> handler) {
+        m_pending = {buffer, &sender, std::move(handler)};
+        if (!m_queue.empty()) complete_pending();
+    }
+
+    size_t available(asio::error_code& ec) const {
+        ec = {};
+        return m_queue.empty() ? 0 : m_queue.front().first.size();
+    }
+
+    size_t receive_from(asio::mutable_buffer buffer,
+                        asio::ip::udp::endpoint& sender, int,
+                        asio::error_code& ec) {
+        if (m_queue.empty()) {
+            ec = asio::error::would_block;
+            return 0;
+        }
+        ec = {};
+        return pop(buffer, sender);
+    }
+
+    void cancel(asio::error_code& ec) {
+        ec = {};
+        if (!m_pending.handler) return;
+        asio::post(get_executor(),
+                   [handler = std::move(m_pending.handler)] {
+                       handler(asio::error::operation_aborted, 0);
+                   });
+        m_pending = {};
+    }
+
+   private:
+    friend class Network;
+
+    struct PendingReceive {
+        asio::mutable_buffer buffer;
+        asio::ip::udp::endpoint* sender = nullptr;
+        std::function<void(asio::error_code, size_t)> handler;
+    };
+
+    void arrive(const std::string& data,
+                const asio::ip::udp::endpoint& from) {
+        if (m_queue.size() >= MAX_QUEUED) return;
+        m_queue.emplace_back(data, from);
+        if (m_pending.handler) complete_pending();
+    }
+
+    size_t pop(asio::mutable_buffer buffer, asio::ip::udp::endpoint& sender) {
+        const auto& [data, from] = m_queue.front();
+        const size_t length = std::min(buffer.size(), data.size());
+        std::memcpy(buffer.data(), data.data(), length);
+        sender = from;
+        m_queue.pop_front();
+        return length;
+    }
+
+    void complete_pending() {
+        PendingReceive pending = std::move(m_pending);
+        m_pending = {};
+        const size_t length = pop(pending.buffer, *pending.sender);
+        asio::post(get_executor(),
+                   [handler = std::move(pending.handler), length] {
+                       handler({}, length);
+                   });
+    }
+
+    Network& m_network;
+    const asio::ip::udp::endpoint m_endpoint;
+    std::deque<std::pair<std::string, asio::ip::udp::endpoint>> m_queue;
+    PendingReceive m_pending;
+};
+
+inline void Network::deliver_due() {
+    while (!m_in_flight.empty() &&
+           m_in_flight.top().arrive_at <= Clock::now()) {
+        const InFlight& packet = m_in_flight.top();
+        auto it = m_sockets.find(packet.to);
+        if (it != m_sockets.end()) {
+            it->second->arrive(*packet.data, packet.from);
+        }
+        m_in_flight.pop();
+    }
+    schedule();
+}
+
+}  // namespace Sim
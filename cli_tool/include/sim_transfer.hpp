@@ -0,0 +1,150 @@
+// One whole transfer in the discrete-event simulation: a sender Session
+// and the receive loop on a Sim::Network, on one thread in virtual time.
+// Built only with ZAPSHARE_SIMULATION (the zapshare_cli_sim library).
+#pragma once
+
+#include <asio.hpp>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "client.hpp"
+#include "crypto.hpp"
+#include "netsim.hpp"
+#include "receive_pool.hpp"
+#include "session.hpp"
+#include "sim.hpp"
+#include "source_file.hpp"
+#include "types.h"
+#include "utils.hpp"
+
+namespace Sim {
+
+struct TransferResult {
+    // The received file checked out against the sender's hash
+    bool completed = false;
+    // Virtual time from the first hello to the verified file
+    Clock::duration elapsed{};
+    // Receiver to sender, and sender to receiver
+    Netsim::Link::Counters up;
+    Netsim::Link::Counters down;
+};
+
+// The sender side of Server, cut down to one socket serving one file: a
+// Session per receiver address, with no crypto workers, tickets or stats.
+class Sender {
+   public:
+    Sender(Network& network, const asio::ip::udp::endpoint& endpoint,
+           std::shared_ptr<ServedFile> served)
+        : m_socket(network, endpoint), m_served(std::move(served)) {
+        m_context.find_transfer = [this](const std::string& id) {
+            return id == m_served->transfer.id ? m_served : nullptr;
+        };
+        m_context.on_closed = [this](Session& session, bool) {
+            auto it = m_sessions.find(session.remote_endpoint());
+            if (it != m_sessions.end() && it->second.get() == &session) {
+                m_sessions.erase(it);
+            }
+        };
+        do_receive();
+    }
+
+    // Closes every session; their coroutines end at their next wait
+    void stop() {
+        m_stopped = true;
+        asio::error_code ec;
+        m_socket.cancel(ec);
+        for (const auto& [endpoint, session] : m_sessions) session->close();
+        m_sessions.clear();
+    }
+
+   private:
+    void do_receive() {
+        ReceiveBuffer::Ptr datagram = m_pool.acquire();
+        ReceiveBuffer& buffer = *datagram;
+        m_socket.async_receive_from(
+            buffer.storage(), buffer.sender,
+            [this, datagram = std::move(datagram)](
+                asio::error_code ec, size_t length) mutable {
+                if (ec || m_stopped) return;
+                datagram->set_size(length);
+                dispatch(std::move(datagram));
+                do_receive();
+            });
+    }
+
+    void dispatch(ReceiveBuffer::Ptr datagram) {
+        const asio::ip::udp::endpoint sender = datagram->sender;
+        auto it = m_sessions.find(sender);
+        if (it != m_sessions.end()) {
+            it->second->deliver(std::move(datagram));
+            return;
+        }
+        auto session = std::make_shared<Session>(m_socket, sender, m_context,
+                                                 ++m_connection_ids);
+        m_sessions.emplace(sender, session);
+        session->deliver(std::move(datagram));
+        session->start();
+    }
+
+    Socket m_socket;
+    std::shared_ptr<ServedFile> m_served;
+    SenderContext m_context;
+    ReceivePool m_pool;
+    std::map<asio::ip::udp::endpoint, std::shared_ptr<Session>> m_sessions;
+    uint64_t m_connection_ids = 0;
+    bool m_stopped = false;
+};
+
+// Sends `source` to `output` over links impaired by `impairment`, each
+// direction with its own seed. Returns once the receiver gives up or has
+// verified the file. The clock restarts for every transfer, so the same
+// arguments always give the same result.
+inline TransferResult run_transfer(const std::string& source,
+                                   const std::string& output,
+                                   const Netsim::Impairment& impairment) {
+    const asio::ip::udp::endpoint sender_ep(
+        asio::ip::make_address("10.0.0.1"), Utils::DEFAULT_PORT);
+    const asio::ip::udp::endpoint receiver_ep(
+        asio::ip::make_address("10.0.0.2"), Utils::DEFAULT_PORT);
+
+    auto served = std::make_shared<ServedFile>();
+    served->file = SourceFile::open(source);
+    if (!served->file) return {};
+    TRANSFERS& transfer = served->transfer;
+    transfer.id = transfer.token = "00000000-0000-4000-8000-000000000001";
+    transfer.file_name = std::filesystem::path(source).filename().string();
+    transfer.file_hash = Crypto::compute_file_hash(source);
+    transfer.file_size = served->file->size();
+    transfer.protocol = "udp";
+    transfer.sender_ip = sender_ep.address().to_string();
+    transfer.sender_port = sender_ep.port();
+
+    Clock::reset();
+    asio::io_context io;
+    Network network(io, impairment);
+    Netsim::Impairment up = impairment;
+    ++up.seed;
+    network.set_link(receiver_ep, sender_ep, up);
+    network.set_link(sender_ep, receiver_ep, impairment);
+
+    Sender sender(network, sender_ep, served);
+    Socket socket(network, receiver_ep);
+
+    TransferResult result;
+    result.completed = receive_via(io, socket, transfer, output);
+    result.elapsed = Clock::now() - Clock::START;
+    result.up = network.link(receiver_ep, sender_ep)->counters();
+    result.down = network.link(sender_ep, receiver_ep)->counters();
+
+    // Let the closed sessions' coroutines unwind before their socket goes
+    sender.stop();
+    io.restart();
+    while (io.poll() > 0) {
+    }
+    return result;
+}
+
+}  // namespace Sim
@@ -0,0 +1,76 @@
+// The file being sent, opened once per sender and shared by every session
+// that serves it. Reads are positional, so sessions never contend for a
+// file offset, and concurrent receivers are served from the same page cache
+// pages instead of each walking the file through its own stream.
+#pragma once
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "sparse.hpp"
+
+class SourceFile {
+   public:
+    // Null when the file cannot be opened. The size and extent map are
+    // taken once here: the file must not change while it is being sent.
+    static std::shared_ptr<SourceFile> open(const std::string& path) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+        std::error_code ec;
+        const uint64_t size = std::filesystem::file_size(path, ec);
+        if (ec) {
+            ::close(fd);
+            return nullptr;
+        }
+#ifdef POSIX_FADV_SEQUENTIAL
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        return std::shared_ptr<SourceFile>(
+            new SourceFile(fd, path, size, Sparse::map_extents(path, size)));
+    }
+
+    ~SourceFile() { ::close(m_fd); }
+
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    const std::string& path() const { return m_path; }
+    uint64_t size() const { return m_size; }
+    const std::vector<Sparse::Extent>& extents() const { return m_extents; }
+
+    // Thread-safe. Returns the bytes read, which is short only at end of
+    // file, or -1 on error.
+    ssize_t read_at(uint64_t offset, char* buffer, size_t length) const {
+        size_t total = 0;
+        while (total < length) {
+            const ssize_t n = ::pread(m_fd, buffer + total, length - total,
+                                      static_cast<off_t>(offset + total));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return -1;
+            if (n == 0) break;
+            total += static_cast<size_t>(n);
+        }
+        return static_cast<ssize_t>(total);
+    }
+
+   private:
+    SourceFile(int fd, std::string path, uint64_t size,
+               std::vector<Sparse::Extent> extents)
+        : m_fd(fd),
+          m_path(std::move(path)),
+          m_size(size),
+          m_extents(std::move(extents)) {}
+
+    int m_fd;
+    std::string m_path;
+    uint64_t m_size;
+    std::vector<Sparse::Extent> m_extents;
+};
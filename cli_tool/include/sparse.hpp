@@ -0,0 +1,87 @@
+// Sparse file helpers: enumerate data extents and holes so the sender can
+// skip unallocated ranges instead of reading and sending zeros.
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace Sparse {
+
+struct Extent {
+    uint64_t offset;
+    uint64_t length;
+    bool hole;
+
+    uint64_t end() const { return offset + length; }
+};
+
+// Maps [0, size) of the file into alternating data and hole extents using
+// SEEK_DATA/SEEK_HOLE. Filesystems (or platforms) without hole support
+// report the whole file as a single data extent.
+inline std::vector<Extent> map_extents(const std::string& path,
+                                       uint64_t size) {
+    std::vector<Extent> extents;
+    if (size == 0) return extents;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        extents.push_back({0, size, false});
+        return extents;
+    }
+
+    off_t pos = 0;
+    while (static_cast<uint64_t>(pos) < size) {
+        off_t data = ::lseek(fd, pos, SEEK_DATA);
+        if (data < 0) {
+            // ENXIO: no more data past pos, the rest is a trailing hole.
+            // Anything else: hole probing unsupported, treat as data.
+            extents.push_back({static_cast<uint64_t>(pos),
+                               size - static_cast<uint64_t>(pos),
+                               errno == ENXIO});
+            break;
+        }
+        if (static_cast<uint64_t>(data) >= size) {
+            extents.push_back({static_cast<uint64_t>(pos),
+                               size - static_cast<uint64_t>(pos), true});
+            break;
+        }
+        if (data > pos) {
+            extents.push_back({static_cast<uint64_t>(pos),
+                               static_cast<uint64_t>(data - pos), true});
+        }
+
+        off_t hole = ::lseek(fd, data, SEEK_HOLE);
+        uint64_t data_end = hole < 0 ? size
+                                     : std::min<uint64_t>(
+                                           static_cast<uint64_t>(hole), size);
+        extents.push_back({static_cast<uint64_t>(data),
+                           data_end - static_cast<uint64_t>(data), false});
+        pos = static_cast<off_t>(data_end);
+    }
+    ::close(fd);
+#else
+    (void)path;
+    extents.push_back({0, size, false});
+#endif
+    return extents;
+}
+
+// Grows (or trims) the file to its final size. Extending with ftruncate
+// leaves the tail unallocated, which recreates a trailing hole that was
+// never written.
+inline void set_final_size(const std::string& path, uint64_t size) {
+    std::error_code ec;
+    if (std::filesystem::file_size(path, ec) != size || ec) {
+        std::filesystem::resize_file(path, size);
+    }
+}
+
+}  // namespace Sparse
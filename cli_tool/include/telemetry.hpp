@@ -0,0 +1,234 @@
+// Live transfer statistics. The packet path only bumps counters in a
+// TransferStats; a Sampler thread reads them every interval and reports
+// the difference, so nothing is formatted or written per packet.
+//
+// ZAPSHARE_STATS picks the output: unset prints a line per transfer per
+// interval, "off" disables sampling, anything else is a file to append
+// JSON lines to ("-" for stdout). ZAPSHARE_STATS_INTERVAL_MS sets the
+// interval, by default DEFAULT_INTERVAL.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "json/json.hpp"
+
+namespace Telemetry {
+
+inline constexpr std::chrono::milliseconds DEFAULT_INTERVAL{1000};
+
+// Written by one thread, read by the sampler. A single writer needs no
+// read-modify-write, so bumping one is a plain load and store.
+class Counter {
+   public:
+    void add(uint64_t n = 1) {
+        m_value.store(m_value.load(std::memory_order_relaxed) + n,
+                      std::memory_order_relaxed);
+    }
+    void set(uint64_t value) {
+        m_value.store(value, std::memory_order_relaxed);
+    }
+    uint64_t get() const { return m_value.load(std::memory_order_relaxed); }
+
+   private:
+    std::atomic<uint64_t> m_value{0};
+};
+
+// One end of one transfer. The sender counts data packets sent and the
+// receiver data packets received; a retransmit is a packet sent again (or,
+// seen from the receiver, a duplicate that arrived or an ack repeated
+// after a timeout). Round trips are timed from a packet to the answer it
+// provoked, leaving out retransmitted ones, whose answer is ambiguous.
+// Stop-and-wait keeps exactly one packet in flight, so there is no window
+// to report.
+struct TransferStats {
+    Counter bytes;
+    Counter packets;
+    Counter retransmits;
+    Counter rtt_samples;
+    Counter rtt_total_us;
+    // Packets read ahead of the one in flight (sender) or datagrams
+    // waiting to be handled (receiver)
+    Counter queue_depth;
+    std::atomic<bool> finished{false};
+
+    void add_rtt(std::chrono::steady_clock::duration rtt) {
+        rtt_samples.add();
+        rtt_total_us.add(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(rtt)
+                .count()));
+    }
+};
+
+class Sampler {
+   public:
+    // Null when ZAPSHARE_STATS=off
+    static std::unique_ptr<Sampler> from_env() {
+        const char* output = std::getenv("ZAPSHARE_STATS");
+        if (output && std::string(output) == "off") return nullptr;
+        std::chrono::milliseconds interval = DEFAULT_INTERVAL;
+        if (const char* env = std::getenv("ZAPSHARE_STATS_INTERVAL_MS")) {
+            interval = std::chrono::milliseconds(
+                std::max(1L, std::strtol(env, nullptr, 10)));
+        }
+        return std::make_unique<Sampler>(output ? output : "", interval);
+    }
+
+    // An empty `json_path` prints text to stdout
+    Sampler(const std::string& json_path, std::chrono::milliseconds interval)
+        : m_interval(interval) {
+        if (json_path == "-") {
+            m_json = &std::cout;
+        } else if (!json_path.empty()) {
+            m_file.open(json_path, std::ios::app);
+            if (m_file) {
+                m_json = &m_file;
+            } else {
+                std::cerr << "Cannot write stats to " << json_path
+                          << std::endl;
+            }
+        }
+        m_thread = std::thread([this] { sample_loop(); });
+    }
+
+    // Takes a last sample, so short transfers are reported too
+    ~Sampler() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_cv.notify_all();
+        m_thread.join();
+    }
+
+    Sampler(const Sampler&) = delete;
+    Sampler& operator=(const Sampler&) = delete;
+
+    // Thread-safe. Reported until it is marked finished or the sampler
+    // goes away.
+    void track(std::string label, std::shared_ptr<const TransferStats> stats) {
+        const auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tracked.push_back(
+            {std::move(label), std::move(stats), {}, now, now});
+    }
+
+   private:
+    struct Snapshot {
+        uint64_t bytes = 0;
+        uint64_t packets = 0;
+        uint64_t retransmits = 0;
+        uint64_t rtt_samples = 0;
+        uint64_t rtt_total_us = 0;
+    };
+
+    struct Tracked {
+        std::string label;
+        std::shared_ptr<const TransferStats> stats;
+        Snapshot last;
+        std::chrono::steady_clock::time_point started_at;
+        std::chrono::steady_clock::time_point sampled_at;
+    };
+
+    void sample_loop() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;) {
+            const bool stopping = m_cv.wait_for(
+                lock, m_interval, [this] { return m_stopping; });
+            sample_all();
+            if (stopping) return;
+        }
+    }
+
+    void sample_all() {
+        const auto now = std::chrono::steady_clock::now();
+        std::erase_if(m_tracked, [&](Tracked& tracked) {
+            // Read before the counters: a finished transfer's last sample
+            // then holds everything it counted.
+            const bool finished = tracked.stats->finished.load() ||
+                                  m_stopping;
+            report(tracked, now, finished);
+            return finished;
+        });
+    }
+
+    void report(Tracked& tracked, std::chrono::steady_clock::time_point now,
+                bool finished) {
+        const TransferStats& stats = *tracked.stats;
+        const Snapshot current{stats.bytes.get(), stats.packets.get(),
+                               stats.retransmits.get(),
+                               stats.rtt_samples.get(),
+                               stats.rtt_total_us.get()};
+        const Snapshot& last = tracked.last;
+        if (current.packets == last.packets &&
+            current.retransmits == last.retransmits && !finished) {
+            return;  // Not started yet, or stalled: keep quiet
+        }
+
+        const double seconds =
+            std::chrono::duration<double>(now - tracked.sampled_at).count();
+        const double elapsed =
+            std::chrono::duration<double>(now - tracked.started_at).count();
+        const uint64_t packets = current.packets - last.packets;
+        const uint64_t retransmits = current.retransmits - last.retransmits;
+        const uint64_t rtt_samples = current.rtt_samples - last.rtt_samples;
+        const double goodput =
+            seconds > 0 ? (current.bytes - last.bytes) / seconds : 0;
+        const double loss =
+            packets > 0 ? static_cast<double>(retransmits) / packets : 0;
+        const double rtt_ms =
+            rtt_samples > 0
+                ? (current.rtt_total_us - last.rtt_total_us) / 1000.0 /
+                      rtt_samples
+                : 0;
+        const uint64_t queue = stats.queue_depth.get();
+
+        if (m_json) {
+            const nlohmann::json line = {
+                {"t", elapsed},          {"peer", tracked.label},
+                {"bytes", current.bytes}, {"goodput_bps", goodput},
+                {"packets", packets},     {"retransmits", retransmits},
+                {"loss", loss},           {"rtt_ms", rtt_ms},
+                {"queue", queue},         {"done", finished}};
+            *m_json << line.dump() << "\n" << std::flush;
+        } else {
+            char text[160];
+            std::snprintf(text, sizeof(text),
+                          "%.1fs %.2f MB/s, %llu pkts, %llu retx (%.2f%% "
+                          "loss), rtt %.3f ms, queue %llu",
+                          elapsed, goodput / 1e6,
+                          static_cast<unsigned long long>(packets),
+                          static_cast<unsigned long long>(retransmits),
+                          loss * 100, rtt_ms,
+                          static_cast<unsigned long long>(queue));
+            std::cout << "[stats] " << tracked.label << " " << text
+                      << std::endl;
+        }
+        tracked.last = current;
+        tracked.sampled_at = now;
+    }
+
+    const std::chrono::milliseconds m_interval;
+    std::ofstream m_file;
+    std::ostream* m_json = nullptr;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::vector<Tracked> m_tracked;
+    bool m_stopping = false;
+    std::thread m_thread;
+};
+
+}  // namespace Telemetry
@@ -0,0 +1,225 @@
+// Event tracing for transfers: every packet each end sent, received and
+// resent, every ack, timeout and round-trip sample, with timestamps, for
+// working out after the fact why a transfer was slow.
+//
+// ZAPSHARE_TRACE=PATH turns it on at startup; start() and stop() switch it
+// at runtime (`zapshare daemon trace PATH|off` for a running daemon). Each
+// thread records into a ring of fixed-size binary Records of its own, and
+// a full ring goes to the file in one write, as does whatever is left in
+// them on stop() or at thread exit. With tracing off, an event costs one
+// relaxed load and a branch.
+//
+// The file is a FileHeader followed by Records in native byte order;
+// zapshare_qlog turns it into qlog JSON. Times come from Transport::Clock,
+// so a simulation traces in virtual time.
+//
+// Stop-and-wait keeps exactly one packet in flight, so there is no
+// congestion window to trace.
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include "transport.hpp"
+
+namespace Trace {
+
+enum class Event : uint8_t {
+    // value: offset, extra: payload bytes
+    PacketSent = 1,
+    PacketReceived = 2,
+    // value: offset of the packet sent again
+    PacketResent = 3,
+    // value: next offset, extra: 1 for the ack that completes the transfer
+    AckSent = 4,
+    AckReceived = 5,
+    // value: consecutive timeouts so far, 0 when the session gave up idle
+    Timeout = 6,
+    // value: microseconds
+    RttSample = 7,
+};
+
+enum class Role : uint8_t { Sender = 0, Receiver = 1 };
+
+struct Record {
+    // Transport::Clock, in nanoseconds since its epoch
+    int64_t time_ns;
+    // The connection ID the sender assigned; both ends record the same one
+    uint64_t connection;
+    uint64_t value;
+    uint32_t extra;
+    Event event;
+    Role role;
+    uint16_t reserved;
+};
+static_assert(sizeof(Record) == 32);
+
+struct FileHeader {
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t record_size;
+};
+
+inline constexpr std::array<char, 8> MAGIC = {'Z', 'A', 'P', 'T',
+                                              'R', 'A', 'C', 'E'};
+inline constexpr uint32_t VERSION = 1;
+// Records a thread buffers before writing them out: 128 KiB
+inline constexpr size_t RING_RECORDS = 4096;
+
+namespace detail {
+
+class Ring;
+
+// The open trace file and every thread's ring, so stop() can drain rings
+// it does not own
+class Sink {
+   public:
+    ~Sink() { close(); }
+
+    // The previous file must have been closed
+    bool open(const std::string& path) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_file = std::fopen(path.c_str(), "ab");
+        if (!m_file) return false;
+        if (std::ftell(m_file) == 0) {
+            const FileHeader header{MAGIC, VERSION, sizeof(Record)};
+            std::fwrite(&header, sizeof(header), 1, m_file);
+        }
+        return true;
+    }
+
+    void close();
+
+    void write(const Record* records, size_t count) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_file) std::fwrite(records, sizeof(Record), count, m_file);
+    }
+
+    void attach(Ring* ring) {
+        std::lock_guard<std::mutex> lock(m_rings_mutex);
+        m_rings.insert(ring);
+    }
+    void detach(Ring* ring) {
+        std::lock_guard<std::mutex> lock(m_rings_mutex);
+        m_rings.erase(ring);
+    }
+
+   private:
+    // Taken before a ring's own lock, which is taken before m_mutex
+    std::mutex m_rings_mutex;
+    std::set<Ring*> m_rings;
+    std::mutex m_mutex;
+    std::FILE* m_file = nullptr;
+};
+
+inline Sink& sink() {
+    static Sink instance;
+    return instance;
+}
+
+inline std::atomic<bool> s_enabled{false};
+
+// One thread's buffered records. Only its thread appends; the lock is
+// there for stop() draining it from another, so it is never contended
+// while tracing runs.
+class Ring {
+   public:
+    Ring() { sink().attach(this); }
+    ~Ring() {
+        sink().detach(this);
+        flush();
+    }
+
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+
+    void push(const Record& record) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_records[m_size++] = record;
+        if (m_size == RING_RECORDS) write_out();
+    }
+
+    void flush() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        write_out();
+    }
+
+   private:
+    void write_out() {
+        if (m_size > 0) sink().write(m_records.data(), m_size);
+        m_size = 0;
+    }
+
+    std::mutex m_mutex;
+    std::array<Record, RING_RECORDS> m_records;
+    size_t m_size = 0;
+};
+
+inline void Sink::close() {
+    {
+        std::lock_guard<std::mutex> lock(m_rings_mutex);
+        for (Ring* ring : m_rings) ring->flush();
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_file) std::fclose(m_file);
+    m_file = nullptr;
+}
+
+inline Ring& ring() {
+    thread_local Ring instance;
+    return instance;
+}
+
+}  // namespace detail
+
+inline bool enabled() {
+    return detail::s_enabled.load(std::memory_order_relaxed);
+}
+
+// Appends to `path`, writing the header if it is new. Ends any trace
+// already running. False if `path` cannot be opened, leaving tracing off.
+inline bool start(const std::string& path) {
+    detail::s_enabled.store(false, std::memory_order_relaxed);
+    detail::sink().close();
+    if (!detail::sink().open(path)) return false;
+    detail::s_enabled.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+// Writes out every thread's records and closes the file
+inline void stop() {
+    detail::s_enabled.store(false, std::memory_order_relaxed);
+    detail::sink().close();
+}
+
+// Starts tracing to ZAPSHARE_TRACE if it is set
+inline void start_from_env() {
+    const char* path = std::getenv("ZAPSHARE_TRACE");
+    if (path && *path && !start(path)) {
+        std::fprintf(stderr, "Cannot write a trace to %s\n", path);
+    }
+}
+
+// An RttSample's value
+inline uint64_t to_micros(Transport::Clock::duration duration) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(duration)
+        .count();
+}
+
+inline void record(Event event, Role role, uint64_t connection,
+                   uint64_t value, uint32_t extra = 0) {
+    if (!enabled()) return;
+    const auto now = Transport::Clock::now().time_since_epoch();
+    detail::ring().push(
+        {std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(),
+         connection, value, extra, event, role, 0});
+}
+
+}  // namespace Trace
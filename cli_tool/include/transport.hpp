@@ -0,0 +1,26 @@
+// The clock, timers and socket the transport runs on. A normal build gets
+// the real ones. ZAPSHARE_SIMULATION swaps in the virtual clock and the
+// in-memory network from sim.hpp, so the same Session and receive loop
+// run in a discrete-event simulation.
+#pragma once
+
+#include <asio.hpp>
+#include <chrono>
+
+#ifdef ZAPSHARE_SIMULATION
+#include "sim.hpp"
+#endif
+
+namespace Transport {
+
+#ifdef ZAPSHARE_SIMULATION
+using Clock = Sim::Clock;
+using Timer = Sim::Timer;
+using Socket = Sim::Socket;
+#else
+using Clock = std::chrono::steady_clock;
+using Timer = asio::steady_timer;
+using Socket = asio::ip::udp::socket;
+#endif
+
+}  // namespace Transport
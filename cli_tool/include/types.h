@@ -14,6 +14,7 @@ so let me see how I can do this
 namespace Command {
 inline constexpr std::string_view SEND = "send";
 inline constexpr std::string_view GET = "get";
+inline constexpr std::string_view DAEMON = "daemon";
 }  // namespace Command
 
 namespace UdpConfig {
@@ -22,6 +23,7 @@ inline constexpr size_t HEADER_SIZE = 128;
 inline constexpr size_t PAYLOAD_SIZE = MAX_PACKET_SIZE - HEADER_SIZE;
 inline constexpr int RETRY_TIMEOUT_MS = 200;
 inline constexpr int MAX_RETRIES = 20;
+inline constexpr size_t SEAL_BATCH = 32;  // Packets read and sealed at once
 }  // namespace UdpConfig
 
 typedef struct Transfer_Metadata {
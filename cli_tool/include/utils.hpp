@@ -7,12 +7,14 @@
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <optional>
 #include <random>
 #include <string>
 #include <thread>
 
 #include "json/json.hpp"
 #include "net/httplib.h"
+#include "transport.hpp"
 #include "types.h"
 
 using json = nlohmann::json;
@@ -24,6 +26,8 @@ struct PublicEndpoint {
     uint16_t port;
     std::string local_ip;  // New
     uint16_t local_port;   // New
+
+    bool operator==(const PublicEndpoint&) const = default;
 };
 
 namespace Utils {
@@ -41,7 +45,12 @@ inline const char* get_env(const char* key) {
     return value;
 }
 
-inline const char* CENTRAL_SERVER_URL = get_env("CENTRAL_SERVER_URL");
+// Read when first needed rather than at static initialization, so that
+// commands which never talk to the rendezvous (and in-process tools that
+// set it themselves) run without it.
+inline const char* central_server_url() {
+    return get_env("CENTRAL_SERVER_URL");
+}
 
 inline TRANSFERS transfer_metadata_from_json(const json& data) {
     TRANSFERS t;
@@ -91,7 +100,7 @@ inline bool check_file_exists(const std::string_view& filepath) {
 }
 
 inline bool look_up(const std::string_view secret) {
-    httplib::Client client(CENTRAL_SERVER_URL);
+    httplib::Client client(central_server_url());
     const std::string url = "/lookup/" + std::string(secret);
     if (auto res = client.Get(url)) {
         if (res->body == "True") {
@@ -102,7 +111,7 @@ inline bool look_up(const std::string_view secret) {
 }
 
 inline TRANSFERS get_transfer_metadata(const std::string_view& secret) {
-    httplib::Client client(CENTRAL_SERVER_URL);
+    httplib::Client client(central_server_url());
     const std::string url = "/getfile/" + std::string(secret);
     if (auto res = client.Get(url)) {
         return transfer_metadata_from_json(json::parse(res->body));
@@ -182,7 +191,7 @@ inline PublicEndpoint get_public_endpoint() {
 // Register discovered public endpoint with central server (Signaling)
 inline void signal_receiver_endpoint(const std::string& id,
                                      const PublicEndpoint& endpoint) {
-    httplib::Client client(CENTRAL_SERVER_URL);
+    httplib::Client client(central_server_url());
     json payload = {{"public_ip", endpoint.ip},
                     {"public_port", endpoint.port},
                     {"local_ip", endpoint.local_ip},
@@ -194,41 +203,46 @@ inline void signal_receiver_endpoint(const std::string& id,
     }
 }
 
-// Poll for receiver's public endpoint (Signaling)
-inline PublicEndpoint poll_for_signal(const std::string& id) {
-    httplib::Client client(CENTRAL_SERVER_URL);
+// Latest receiver endpoint signalled for `id`, if any (Signaling)
+inline std::optional<PublicEndpoint> fetch_signal(const std::string& id) {
+    httplib::Client client(central_server_url());
     std::string url = "/signal/" + id;
 
-    for (int i = 0; i < 30; ++i) {  // Try for 30 seconds
-        if (auto res = client.Get(url.c_str())) {
-            if (res->status == 200) {
-                try {
-                    json data = json::parse(res->body);
-                    PublicEndpoint ep;
-                    ep.ip = data["public_ip"];
-                    ep.port = data["public_port"];
-                    ep.local_ip =
-                        data.contains("local_ip") ? data["local_ip"] : "";
-                    ep.local_port = data.contains("local_port")
-                                        ? data["local_port"].get<uint16_t>()
-                                        : 0;
-                    return ep;
-                } catch (std::exception& e) {
-                    std::cerr << "Poll parse error: " << e.what() << std::endl;
-                } catch (...) {
-                    std::cerr << "Poll parse error: Unknown" << std::endl;
-                }
+    if (auto res = client.Get(url.c_str())) {
+        if (res->status == 200) {
+            try {
+                json data = json::parse(res->body);
+                PublicEndpoint ep;
+                ep.ip = data["public_ip"];
+                ep.port = data["public_port"];
+                ep.local_ip = data.contains("local_ip") ? data["local_ip"] : "";
+                ep.local_port = data.contains("local_port")
+                                    ? data["local_port"].get<uint16_t>()
+                                    : 0;
+                return ep;
+            } catch (std::exception& e) {
+                std::cerr << "Poll parse error: " << e.what() << std::endl;
+            } catch (...) {
+                std::cerr << "Poll parse error: Unknown" << std::endl;
             }
         }
+    }
+    return std::nullopt;
+}
+
+// Poll for receiver's public endpoint (Signaling)
+inline PublicEndpoint poll_for_signal(const std::string& id) {
+    for (int i = 0; i < 30; ++i) {  // Try for 30 seconds
+        if (auto ep = fetch_signal(id)) return *ep;
         std::this_thread::sleep_for(std::chrono::seconds(1));
     }
     throw std::runtime_error("No Signal Received! Timed out");
 }
 
-// Perform UDP hole punching to peer's public endpoint using an EXISTING socket
-// Now tries both Public and Local
-inline void perform_udp_hole_punch(ip::udp::socket& socket,
-                                   const PublicEndpoint& peer_endpoint) {
+// One round of hole punching: a single PUNCH to the peer's public and
+// local candidates. Never blocks, so it is safe on an I/O thread.
+inline void send_udp_punch(Transport::Socket& socket,
+                           const PublicEndpoint& peer_endpoint) {
     try {
         std::vector<ip::udp::endpoint> candidates;
         candidates.emplace_back(asio::ip::make_address(peer_endpoint.ip),
@@ -241,21 +255,26 @@ inline void perform_udp_hole_punch(ip::udp::socket& socket,
         }
 
         std::string punch_msg = "PUNCH";
-        // Send multiple punches to all candidates
-        for (int i = 0; i < 5; ++i) {
-            for (const auto& endpoint : candidates) {
-                try {
-                    socket.send_to(asio::buffer(punch_msg), endpoint);
-                } catch (...) {
-                }  // Ignore send errors (e.g. unreachable)
-            }
-            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        for (const auto& endpoint : candidates) {
+            asio::error_code ec;  // Ignore send errors (e.g. unreachable)
+            socket.send_to(asio::buffer(punch_msg), endpoint, 0, ec);
         }
     } catch (std::exception& e) {
         std::cerr << "Hole punch error: " << e.what() << "\n";
     }
 }
 
+// Perform UDP hole punching to peer's public endpoint using an EXISTING socket
+// Now tries both Public and Local
+inline void perform_udp_hole_punch(Transport::Socket& socket,
+                                   const PublicEndpoint& peer_endpoint) {
+    // Send multiple punches to all candidates
+    for (int i = 0; i < 5; ++i) {
+        send_udp_punch(socket, peer_endpoint);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+}
+
 // Generate a UUID v4 token (RFC 4122) using std::random_device
 inline std::string generate_uuid_token() {
     std::random_device rd;
@@ -281,9 +300,26 @@ inline std::string generate_uuid_token() {
     return oss.str();
 }
 
+// Describes `file_path` as a new transfer under a fresh secret. The caller
+// fills in the public sender_ip before registering it.
+inline TRANSFERS new_transfer(const std::string& file_path,
+                              const std::string& file_hash) {
+    TRANSFERS transfer{};
+    transfer.file_name = std::filesystem::path(file_path).filename().string();
+    transfer.file_hash = file_hash;
+    transfer.file_size = std::filesystem::file_size(file_path);
+    transfer.protocol = "udp";
+    transfer.sender_port = DEFAULT_PORT;
+    transfer.token = generate_uuid_token();
+    transfer.id = transfer.token;
+    transfer.sender_local_ip = get_local_ip_address();
+    transfer.sender_local_port = DEFAULT_PORT;
+    return transfer;
+}
+
 // Register transfer metadata with rendezvous server
 inline void register_transfer(const TRANSFERS& t) {
-    httplib::Client client(CENTRAL_SERVER_URL);
+    httplib::Client client(central_server_url());
 
     // Pack Local IP into sender_ip for legacy server compatibility
     std::string packed_ip = t.sender_ip;
@@ -3,18 +3,27 @@
 #include "asio.hpp"
 #include "client.hpp"
 #include "crypto.hpp"
+#include "daemon.hpp"
 #include "error.hpp"
+#include "keys.hpp"
+#include "resumption.hpp"
 #include "server.hpp"
+#include "trace.hpp"
 #include "types.h"
 #include "utils.hpp"
 
-void start_server(const std::string& file_path,
-                  const std::string& transfer_id) {
+// Exit code: 1 unless a receiver got the whole file
+int start_server(const std::string& file_path, const TRANSFERS& transfer) {
     asio::io_context io;
-    Server s(io, 5173, file_path);
+    Server s(io, 5173);
+    if (!s.add_transfer(file_path, transfer)) {
+        Error::invalid_file_path();
+        return 1;
+    }
     // Server run will poll for signal and then start
-    s.run(transfer_id);
+    s.run();
     io.run();
+    return s.receivers_finished() > 0 ? 0 : 1;
 }
 
 int main(int argc, char* argv[]) {
@@ -23,6 +32,15 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     const std::string_view cmd = argv[1];
+    Trace::start_from_env();
+
+    // Load (or create) the long-term identity once, before any handshake
+    try {
+        Keys::identity();
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to load identity: " << e.what() << std::endl;
+        return 1;
+    }
     if (cmd == Command::SEND) {
         if (argc < 3) {
             Error::invalid_file_path();
@@ -33,15 +51,21 @@ int main(int argc, char* argv[]) {
             Error::invalid_file_path();
             return 1;
         }
-        TRANSFERS transfer{};
-        transfer.file_name =
-            std::filesystem::path(filepath).filename().string();
-        transfer.file_hash = Crypto::compute_file_hash(filepath);
-        transfer.file_size = std::filesystem::file_size(filepath);
-        transfer.protocol = "udp";
-        transfer.sender_port = 5173;
-        transfer.token = Utils::generate_uuid_token();
-        transfer.id = transfer.token;
+
+        // A running daemon already has the socket, keys and STUN result
+        try {
+            if (const auto secret = Daemon::offer(std::string(filepath))) {
+                std::cout << "Your secret is: " << *secret
+                          << " share this with the receiver!!\n";
+                return 0;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Daemon refused the file: " << e.what() << std::endl;
+            return 1;
+        }
+
+        TRANSFERS transfer = Utils::new_transfer(
+            std::string(filepath), Crypto::compute_file_hash(filepath));
 
         // Discover public endpoint via STUN
         try {
@@ -54,9 +78,6 @@ int main(int argc, char* argv[]) {
             transfer.sender_ip = "127.0.0.1";
         }
 
-        // Discover Local IP
-        transfer.sender_local_ip = Utils::get_local_ip_address();
-        transfer.sender_local_port = 5173;
         std::cout << "Local endpoint: " << transfer.sender_local_ip << ":"
                   << transfer.sender_local_port << std::endl;
 
@@ -66,26 +87,32 @@ int main(int argc, char* argv[]) {
                   << " share this with the receiver!!\n";
 
         // Start server
-        start_server(std::string(filepath), transfer.id);
+        if (const int status = start_server(std::string(filepath), transfer)) {
+            return status;
+        }
+    } else if (cmd == Command::DAEMON) {
+        if (argc < 3) return Daemon::run();
+        return Daemon::control(std::vector<std::string>(argv + 2, argv + argc));
     } else if (cmd == Command::GET) {
         if (argc < 3) {
             Error::invalid_secret();
             return 1;
         }
         const std::string_view secret = argv[2];
-        if (!Utils::look_up(secret)) {
-            Error::invalid_secret();
-            return 1;
+        TRANSFERS peer_transfer{};
+        if (const auto cached =
+                Resumption::load_ticket(std::string(secret))) {
+            // The sender checks its own ticket; no rendezvous round trips
+            peer_transfer.file_name = cached->file_name;
+            peer_transfer.sender_ip = cached->peer_ip;
+        } else {
+            if (!Utils::look_up(secret)) {
+                Error::invalid_secret();
+                return 1;
+            }
+            peer_transfer = Utils::get_transfer_metadata(secret);
         }
-        TRANSFERS peer_transfer = Utils::get_transfer_metadata(secret);
-
-        std::string host_override = std::getenv("ZAPSHARE_HOST_OVERRIDE")
-                                        ? std::getenv("ZAPSHARE_HOST_OVERRIDE")
-                                        : "";
-        std::string connect_host =
-            host_override.empty() ? peer_transfer.sender_ip : host_override;
 
-        // Use Sender's IP and Port (5173 or whatever registered)
         if (!run_client_session(std::string(secret), peer_transfer.file_name)) {
             std::cerr << "File download failed" << std::endl;
             return 1;
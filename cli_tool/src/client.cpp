@@ -1,7 +1,12 @@
 #include "client.hpp"
 
+#include <algorithm>
 #include <asio.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <optional>
 #include <sstream>
@@ -10,6 +15,14 @@
 
 #include "crypto.hpp"
 #include "crypto/session_crypto.hpp"
+#include "handshake.hpp"
+#include "keys.hpp"
+#include "resumption.hpp"
+#include "secure_channel.hpp"
+#include "sparse.hpp"
+#include "telemetry.hpp"
+#include "trace.hpp"
+#include "transport.hpp"
 #include "types.h"
 #include "utils.hpp"
 #include "v1/control.pb.h"
@@ -21,9 +34,48 @@ namespace {
 
 struct ConnectedPeer {
     udp::endpoint endpoint;
-    SessionKeys keys;
+    SecureChannel channel;
+    // Set when the sender issued a resumption ticket; the file fields are
+    // left for the caller.
+    std::optional<Resumption::CachedTicket> ticket;
 };
 
+// Unanswered: the sender never took up the request (timed out, or refused
+// it with a HandshakeError), so a fresh attempt may still succeed.
+enum class TransferOutcome { Complete, Failed, Unanswered };
+
+#ifndef ZAPSHARE_SIMULATION
+// ZAPSHARE_HOST_OVERRIDE=HOST[:PORT] reaches the sender at another
+// address, such as a zapshare_netem relay in front of it. The port
+// defaults to `port`, the sender's own. Throws for an unusable address.
+std::optional<udp::endpoint> host_override(uint16_t port) {
+    const char* env = std::getenv("ZAPSHARE_HOST_OVERRIDE");
+    if (!env || !*env) return std::nullopt;
+    std::string host = env;
+    const size_t colon = host.rfind(':');
+    // A single colon separates the port; more make an IPv6 address
+    if (colon != std::string::npos && host.find(':') == colon) {
+        port = static_cast<uint16_t>(std::stoul(host.substr(colon + 1)));
+        host.resize(colon);
+    }
+    return udp::endpoint(asio::ip::make_address(host), port);
+}
+
+// Points the whole exchange, hole punching included, at the override.
+// The sender's LAN candidate goes too, so nothing bypasses it.
+void apply_host_override(TRANSFERS& t) {
+    const auto endpoint =
+        host_override(static_cast<uint16_t>(t.sender_port));
+    if (!endpoint) return;
+    t.sender_ip = endpoint->address().to_string();
+    t.sender_port = endpoint->port();
+    t.sender_local_ip.clear();
+    t.sender_local_port = 0;
+    std::cout << "Reaching the sender through " << t.sender_ip << ":"
+              << t.sender_port << std::endl;
+}
+#endif
+
 std::vector<udp::endpoint> build_peer_candidates(const TRANSFERS& t) {
     std::vector<udp::endpoint> peers;
     peers.emplace_back(asio::ip::make_address(t.sender_ip), t.sender_port);
@@ -36,49 +88,144 @@ std::vector<udp::endpoint> build_peer_candidates(const TRANSFERS& t) {
     return peers;
 }
 
-bool recv_with_timeout(asio::io_context& io, udp::socket& socket,
-                       std::array<char, UdpConfig::MAX_PACKET_SIZE>& buffer,
-                       udp::endpoint& sender, std::string& data,
-                       int timeout_ms) {
-    bool received = false;
-    asio::steady_timer timer(io, std::chrono::milliseconds(timeout_ms));
-    socket.async_receive_from(asio::buffer(buffer), sender,
-                              [&](asio::error_code ec, size_t len) {
-                                  if (!ec) {
-                                      received = true;
-                                      data.assign(buffer.data(), len);
-                                      timer.cancel();
-                                  }
-                              });
-    timer.async_wait([&](auto) {
-        if (!received) socket.cancel();
-    });
-    io.restart();
-    io.run();
-    return received;
+Transport::Clock::time_point retry_deadline(
+    Transport::Clock::time_point now = Transport::Clock::now()) {
+    return now + std::chrono::milliseconds(UdpConfig::RETRY_TIMEOUT_MS);
 }
 
-std::string sign_client_hello(const zapshare::v1::ClientHello& hello,
-                              const IdentityKeyPair& receiver_identity) {
-    std::string transcript = "";
-    transcript += "client_hello";
-    transcript += std::to_string(hello.version());
-    transcript += hello.transfer_id();
-    transcript += hello.token();
-    transcript += hello.receiver_nonce();
-    const auto& identity = hello.receiver_identity();
-    transcript += identity.long_term_public_key();
-    transcript += identity.ephemeral_public_key();
-    return sign(transcript, receiver_identity);
-}
+// The receive side of the socket, kept armed for as long as it lives.
+// Datagrams are queued as they land, together with whatever else is already
+// waiting in the socket buffer, and the client's coroutine co_awaits them
+// one at a time with a deadline. The socket must not be read any other way
+// (e.g. for STUN) meanwhile.
+class DatagramReceiver {
+   public:
+    struct Datagram {
+        std::string data;
+        udp::endpoint sender;
+    };
+
+    // Beyond this the sender is far ahead of us; stop-and-wait resends
+    // whatever is dropped.
+    static constexpr size_t MAX_QUEUED = 256;
+
+    DatagramReceiver(asio::io_context& io, Transport::Socket& socket)
+        : m_io(io), m_socket(socket), m_wake(io) {
+        arm();
+    }
+
+    ~DatagramReceiver() {
+        stop();
+        m_io.restart();
+        while (m_armed && m_io.run_one() > 0) {
+        }
+    }
+
+    DatagramReceiver(const DatagramReceiver&) = delete;
+    DatagramReceiver& operator=(const DatagramReceiver&) = delete;
+
+    // Moves the next datagram into `out`, whose old storage is reused for
+    // later ones. False once `deadline` passes with nothing received.
+    asio::awaitable<bool> next(Datagram& out,
+                               Transport::Clock::time_point deadline) {
+        // The timer stands in for a condition variable: a landing datagram
+        // cancels it.
+        while (m_queue.empty()) {
+            if (Transport::Clock::now() >= deadline) co_return false;
+            m_wake.expires_at(deadline);
+            asio::error_code ec;
+            co_await m_wake.async_wait(
+                asio::redirect_error(asio::use_awaitable, ec));
+        }
+        std::swap(out, m_queue.front());
+        m_spare.push_back(std::move(m_queue.front().data));
+        m_queue.pop_front();
+        co_return true;
+    }
+
+    size_t queued() const { return m_queue.size(); }
+
+    // Stops receiving, so the io_context runs out of work
+    void stop() {
+        m_stopping = true;
+        asio::error_code ec;
+        m_socket.cancel(ec);
+        m_wake.cancel();
+    }
+
+   private:
+    void arm() {
+        m_armed = true;
+        m_socket.async_receive_from(
+            asio::buffer(m_buffer), m_sender,
+            [this](asio::error_code ec, size_t length) {
+                m_armed = false;
+                if (!ec) {
+                    push(length);
+                    drain();
+                    m_wake.cancel();
+                }
+                // UDP errors (ICMP unreachable and the like) are transient
+                if (!m_stopping && ec != asio::error::operation_aborted) arm();
+            });
+    }
+
+    // Takes the datagrams that arrived along with the one just completed
+    // without going back through the reactor.
+    void drain() {
+        asio::error_code ec;
+        while (m_socket.available(ec) > 0 && !ec) {
+            const size_t length =
+                m_socket.receive_from(asio::buffer(m_buffer), m_sender, 0, ec);
+            if (ec) break;
+            push(length);
+        }
+    }
+
+    void push(size_t length) {
+        if (m_queue.size() >= MAX_QUEUED) return;
+        std::string data;
+        if (!m_spare.empty()) {
+            data = std::move(m_spare.back());
+            m_spare.pop_back();
+        }
+        data.assign(m_buffer.data(), length);
+        m_queue.push_back({std::move(data), m_sender});
+    }
+
+    asio::io_context& m_io;
+    Transport::Socket& m_socket;
+    Transport::Timer m_wake;
+    std::array<char, UdpConfig::MAX_PACKET_SIZE> m_buffer;
+    udp::endpoint m_sender;
+    std::deque<Datagram> m_queue;
+    std::vector<std::string> m_spare;
+    bool m_armed = false;
+    bool m_stopping = false;
+};
 
-std::optional<udp::endpoint> perform_handshake(
-    asio::io_context& io, udp::socket& socket,
-    const std::vector<udp::endpoint>& peers, PublicEndpoint& sender_ep,
-    const std::string& token) {
-    Utils::perform_udp_hole_punch(socket, sender_ep);
+// Waits out one retry interval for our ServerHello, skipping anything else
+// that arrives meanwhile.
+asio::awaitable<bool> receive_server_hello(
+    DatagramReceiver& receiver, const std::string& token,
+    zapshare::v1::HandshakePacket* response, udp::endpoint* sender) {
+    const auto deadline = retry_deadline();
+    DatagramReceiver::Datagram datagram;
+    while (co_await receiver.next(datagram, deadline)) {
+        if (response->ParseFromString(datagram.data) &&
+            response->has_server_hello() &&
+            response->server_hello().transfer_id() == token) {
+            *sender = datagram.sender;
+            co_return true;
+        }
+    }
+    co_return false;
+}
 
-    std::array<char, UdpConfig::MAX_PACKET_SIZE> buf;
+asio::awaitable<std::optional<ConnectedPeer>> perform_handshake(
+    DatagramReceiver& receiver, Transport::Socket& socket,
+    const std::vector<udp::endpoint>& peers, const std::string& token,
+    bool secure_transport) {
     udp::endpoint sender;  // Packet source
 
     // Handshake
@@ -88,22 +235,27 @@ std::optional<udp::endpoint> perform_handshake(
     hello->set_transfer_id(token);
     hello->set_token(token);
 
-    // TODO: need to implement
-    IdentityKeyPair receiver_identity = generate_identity_keypair();
-    EphemeralKeyPair receiver_ephemeral = generate_ephemeral_keypair();
+    const IdentityKeyPair& receiver_identity = Keys::identity();
+    const EphemeralKeyPair receiver_ephemeral = Keys::take_ephemeral();
     std::string receiver_nonce = random_nonce(32);
     hello->set_receiver_nonce(receiver_nonce);
     auto* identity = hello->mutable_receiver_identity();
     identity->set_ephemeral_public_key(receiver_ephemeral.public_key);
     identity->set_long_term_public_key(receiver_identity.public_key);
+    hello->set_secure_transport(secure_transport);
+    if (secure_transport) {
+        for (auto suite : Handshake::supported_cipher_suites()) {
+            hello->add_cipher_suites(suite);
+        }
+    }
 
-    hello->set_receiver_signature(sign_client_hello(*hello, receiver_identity));
+    hello->set_receiver_signature(
+        Handshake::sign_client_hello(*hello, receiver_identity));
 
     std::string bytes;
     handshake_packet.SerializeToString(&bytes);
-    std::string rx;
     bool connected = false;
-    udp::endpoint connected_peer;
+    ConnectedPeer connected_peer;
 
     for (int i = 0; i < UdpConfig::MAX_RETRIES; ++i) {
         // Send HELLO to All Candidates
@@ -115,76 +267,192 @@ std::optional<udp::endpoint> perform_handshake(
         }
 
         zapshare::v1::HandshakePacket response;
-        if (recv_with_timeout(io, socket, buf, sender, rx,
-                              UdpConfig::RETRY_TIMEOUT_MS) &&
-            response.ParseFromString(rx) && response.has_server_hello() &&
-            response.server_hello().transfer_id() == token) {
+        if (co_await receive_server_hello(receiver, token, &response,
+                                          &sender)) {
+            const auto& server_hello = response.server_hello();
+            if (!Handshake::verify_server_hello(server_hello)) {
+                std::cerr << "Bad sender signature" << std::endl;
+                continue;
+            }
+            if (server_hello.secure_transport()) {
+                // Older senders leave the suite unset: XChaCha20
+                const auto suite = server_hello.cipher_suite();
+                if (suite != zapshare::v1::CIPHER_SUITE_UNSPECIFIED &&
+                    std::find(hello->cipher_suites().begin(),
+                              hello->cipher_suites().end(),
+                              suite) == hello->cipher_suites().end()) {
+                    std::cerr << "Sender picked a cipher suite we did not "
+                                 "offer"
+                              << std::endl;
+                    continue;
+                }
+                try {
+                    const SessionKeys keys = derive_client_keys(
+                        receiver_ephemeral,
+                        server_hello.sender_identity().ephemeral_public_key());
+                    connected_peer.channel = SecureChannel(
+                        keys, token, Handshake::to_aead_cipher(suite));
+                    connected_peer.channel.set_connection_id(
+                        server_hello.connection_id());
+                    if (!server_hello.resumption_ticket().empty()) {
+                        Resumption::CachedTicket ticket;
+                        ticket.ticket = server_hello.resumption_ticket();
+                        ticket.resumption_secret =
+                            derive_resumption_secret(keys, true);
+                        ticket.cipher_suite =
+                            suite == zapshare::v1::CIPHER_SUITE_UNSPECIFIED
+                                ? zapshare::v1::CIPHER_SUITE_XCHACHA20_POLY1305
+                                : suite;
+                        ticket.expires_at = Resumption::unix_now() +
+                                            server_hello.ticket_lifetime();
+                        ticket.peer_ip = sender.address().to_string();
+                        ticket.peer_port = sender.port();
+                        connected_peer.ticket = std::move(ticket);
+                    }
+                } catch (const std::exception& e) {
+                    std::cerr << "Key derivation failed: " << e.what()
+                              << std::endl;
+                    continue;
+                }
+            }
             connected = true;
-            connected_peer = sender;
+            connected_peer.endpoint = sender;
             break;
         }
         std::cout << "Handshake retry " << i + 1 << std::endl;
     }
     if (connected) {
-        return std::move(connected_peer);
+        co_return std::move(connected_peer);
     }
-    return std::nullopt;
+    co_return std::nullopt;
 }
 
-std::string build_get_request(const std::string& transfer_id) {
+zapshare::v1::ControlPacket build_get_request(const std::string& transfer_id) {
     // Get File
     zapshare::v1::ControlPacket control_packet;
     auto* get_request = control_packet.mutable_get();
 
     get_request->set_transfer_id(transfer_id);
+    return control_packet;
+}
 
-    std::string get_bytes;
-    control_packet.SerializeToString(&get_bytes);
-    return get_bytes;
+bool send_control(Transport::Socket& socket, const udp::endpoint& peer,
+                  SecureChannel& channel,
+                  const zapshare::v1::ControlPacket& packet) {
+    std::string bytes;
+    if (!channel.encode(packet, &bytes)) return false;
+    socket.send_to(asio::buffer(bytes), peer);
+    return true;
 }
 
-bool send_ack(udp::socket& socket, const udp::endpoint& peer,
-              const std::string& transfer_id, uint64_t next_offset) {
-    zapshare::v1::ControlPacket ack_packet;
-    auto* ack = ack_packet.mutable_ack();
-    ack->set_transfer_id(transfer_id);
-    ack->set_next_offset(next_offset);
+// One ack goes out per packet received, so the message and the datagram
+// buffer are built once and reused for all of them.
+class AckSender {
+   public:
+    AckSender(Transport::Socket& socket, ConnectedPeer& connection,
+              const std::string& transfer_id)
+        : m_socket(socket), m_connection(connection) {
+        m_packet.mutable_ack()->set_transfer_id(transfer_id);
+    }
 
-    std::string ack_bytes;
-    if (!ack_packet.SerializeToString(&ack_bytes)) return false;
-    socket.send_to(asio::buffer(ack_bytes), peer);
-    return true;
+    bool send(uint64_t next_offset, bool complete = false) {
+        auto* ack = m_packet.mutable_ack();
+        m_repeated = ack->next_offset() == next_offset;
+        ack->set_next_offset(next_offset);
+        ack->set_complete(complete);
+        m_sent_at = Transport::Clock::now();
+        if (!m_connection.channel.encode(m_packet, &m_datagram)) return false;
+        m_socket.send_to(asio::buffer(m_datagram), m_connection.endpoint);
+        Trace::record(Trace::Event::AckSent, Trace::Role::Receiver,
+                      m_connection.channel.connection_id(), next_offset,
+                      complete);
+        return true;
+    }
+
+    // How long the packet arriving at `now` took to follow the last ack.
+    // Empty before the first ack and after a repeated one, which the
+    // packet may answer either copy of.
+    std::optional<Transport::Clock::duration> round_trip(
+        Transport::Clock::time_point now) const {
+        if (m_repeated || m_sent_at == Transport::Clock::time_point{})
+            return std::nullopt;
+        return now - m_sent_at;
+    }
+
+   private:
+    Transport::Socket& m_socket;
+    ConnectedPeer& m_connection;
+    zapshare::v1::ControlPacket m_packet;
+    std::string m_datagram;
+    Transport::Clock::time_point m_sent_at;
+    bool m_repeated = false;
+};
+
+bool is_handshake_error(const std::string& datagram) {
+    zapshare::v1::HandshakePacket packet;
+    return packet.ParseFromString(datagram) && packet.has_error();
 }
 
-bool receive_file(asio::io_context& io, udp::socket& socket,
-                  const udp::endpoint& peer, const std::string& transfer_id,
-                  const std::string& output_filename,
-                  const std::string& expected_hash,
-                  const std::string& get_bytes) {
+// `request_transfer` sends whatever opens the transfer and is repeated
+// until the first packet arrives. Until then at most `opening_retries`
+// timeouts are allowed. A timeout is RETRY_TIMEOUT_MS without a packet
+// from the peer; strays do not extend it.
+asio::awaitable<TransferOutcome> receive_file(
+    DatagramReceiver& receiver, Transport::Socket& socket,
+    ConnectedPeer& connection, const std::string& transfer_id,
+    const std::string& output_filename, const std::string& expected_hash,
+    const std::function<void()>& request_transfer,
+    int opening_retries = UdpConfig::MAX_RETRIES) {
+    const udp::endpoint& peer = connection.endpoint;
+    SecureChannel& channel = connection.channel;
     std::ofstream out(output_filename, std::ios::binary | std::ios::trunc);
-    socket.send_to(asio::buffer(get_bytes), peer);
-
-    std::array<char, UdpConfig::MAX_PACKET_SIZE> buf;
-    udp::endpoint sender;
-    std::string rx;
+    AckSender acks(socket, connection, transfer_id);
+    // Progress is reported by the sampler, never per packet
+    const std::unique_ptr<Telemetry::Sampler> sampler =
+        Telemetry::Sampler::from_env();
+    const auto stats = std::make_shared<Telemetry::TransferStats>();
+    if (sampler) {
+        sampler->track(
+            peer.address().to_string() + ":" + std::to_string(peer.port()),
+            stats);
+    }
+    const auto trace = [&channel](Trace::Event event, uint64_t value,
+                                  uint32_t extra = 0) {
+        Trace::record(event, Trace::Role::Receiver, channel.connection_id(),
+                      value, extra);
+    };
+    request_transfer();
+
+    DatagramReceiver::Datagram datagram;
+    const std::string& rx = datagram.data;
+    // Reused so each datagram decodes into the previous one's body
+    zapshare::v1::ControlPacket packet;
 
     // Stop-and-Wait Loop
     size_t current_offset = 0;
 
     int retries = 0;
-    while (retries < UdpConfig::MAX_RETRIES) {
-        if (recv_with_timeout(io, socket, buf, sender, rx,
-                              UdpConfig::RETRY_TIMEOUT_MS)) {
-            if (sender != peer) {
+    bool answered = false;
+    auto deadline = retry_deadline();
+    while (retries < (answered ? UdpConfig::MAX_RETRIES : opening_retries)) {
+        if (co_await receiver.next(datagram, deadline)) {
+            if (datagram.sender != peer) {
                 continue;
             }
 
             retries = 0;
-
-            zapshare::v1::ControlPacket packet;
-            if (!packet.ParseFromString(rx)) {
+            const auto now = Transport::Clock::now();
+            deadline = retry_deadline(now);
+            stats->queue_depth.set(receiver.queued());
+
+            if (!channel.decode(rx.data(), rx.size(), &packet)) {
+                if (!answered && is_handshake_error(rx)) {
+                    std::cerr << "Sender refused the request." << std::endl;
+                    co_return TransferOutcome::Unanswered;
+                }
                 continue;
             }
+            answered = true;
             if (packet.has_data()) {
                 const auto& data = packet.data();
                 if (data.transfer_id() != transfer_id) {
@@ -193,16 +461,44 @@ bool receive_file(asio::io_context& io, udp::socket& socket,
                 const size_t off = static_cast<size_t>(data.offset());
                 const std::string& payload = data.payload();
 
+                stats->packets.add();
+                trace(Trace::Event::PacketReceived, off,
+                      static_cast<uint32_t>(payload.size()));
                 if (off == current_offset) {
                     out.seekp(off);
                     out.write(payload.data(),
                               static_cast<std::streamsize>(payload.size()));
                     current_offset += payload.size();
-                    std::cout << "Received: " << current_offset << " bytes"
-                              << std::flush;
-                    send_ack(socket, peer, transfer_id, current_offset);
+                    if (const auto rtt = acks.round_trip(now)) {
+                        stats->add_rtt(*rtt);
+                        trace(Trace::Event::RttSample,
+                              Trace::to_micros(*rtt));
+                    }
+                    stats->bytes.add(payload.size());
+                    acks.send(current_offset);
                 } else if (off < current_offset) {
-                    send_ack(socket, peer, transfer_id, current_offset);
+                    stats->retransmits.add();
+                    acks.send(current_offset);
+                }
+            }
+
+            if (packet.has_hole()) {
+                const auto& hole = packet.hole();
+                if (hole.transfer_id() != transfer_id) {
+                    continue;
+                }
+                // Nothing to write: the next seekp past the hole leaves the
+                // range unallocated, and a trailing hole is restored by
+                // Sparse::set_final_size once DONE arrives.
+                stats->packets.add();
+                trace(Trace::Event::PacketReceived, hole.offset());
+                if (hole.offset() == current_offset) {
+                    current_offset += static_cast<size_t>(hole.length());
+                    stats->bytes.add(hole.length());
+                    acks.send(current_offset);
+                } else if (hole.offset() < current_offset) {
+                    stats->retransmits.add();
+                    acks.send(current_offset);
                 }
             }
 
@@ -212,6 +508,7 @@ bool receive_file(asio::io_context& io, udp::socket& socket,
                 if (done.transfer_id() != transfer_id) {
                     continue;
                 }
+                trace(Trace::Event::PacketReceived, done.final_size());
 
                 if (current_offset != done.final_size()) {
                     continue;
@@ -219,42 +516,190 @@ bool receive_file(asio::io_context& io, udp::socket& socket,
 
                 out.flush();
                 out.close();
+                Sparse::set_final_size(output_filename, done.final_size());
 
                 const std::string file_hash =
                     Crypto::compute_file_hash(output_filename);
 
                 if (file_hash != expected_hash) {
                     std::cerr << "\nFile hash mismatch." << std::endl;
-                    return false;
+                    co_return TransferOutcome::Failed;
                 }
-                send_ack(socket, peer, transfer_id, current_offset);
+                acks.send(current_offset, true);
                 std::cout << "\nTransfer Complete!" << std::endl;
-                return true;
+                co_return TransferOutcome::Complete;
             }
 
             if (packet.has_error()) {
                 std::cerr << "Peer returned error: " << packet.error().message()
                           << std::endl;
-                return false;
+                co_return TransferOutcome::Failed;
             }
         } else {
             // Timeout
             std::cout << "\rTimeout, resending ACK... " << std::flush;
             retries++;
+            deadline = retry_deadline();
+            trace(Trace::Event::Timeout, static_cast<uint64_t>(retries));
 
-            if (current_offset == 0) {
-                socket.send_to(asio::buffer(get_bytes), peer);
+            if (!answered) {
+                request_transfer();
             } else {
-                send_ack(socket, peer, transfer_id, current_offset);
+                stats->retransmits.add();
+                acks.send(current_offset);
             }
         }
     }
     std::cerr << "\nClient timed out." << std::endl;
-    return false;
+    co_return answered ? TransferOutcome::Failed : TransferOutcome::Unanswered;
+}
+
+#ifndef ZAPSHARE_SIMULATION
+// 0-RTT reconnect: the cached ticket and the first request go out in one
+// datagram to the sender we last talked to, with no rendezvous lookups and
+// no key exchange.
+asio::awaitable<TransferOutcome> resume_transfer(
+    DatagramReceiver& receiver, Transport::Socket& socket,
+    const std::string& token, const Resumption::CachedTicket& cached,
+    const std::string& output_filename) {
+    ConnectedPeer connection;
+    zapshare::v1::HandshakePacket packet;
+    auto* hello = packet.mutable_resume_hello();
+    const std::string receiver_nonce = random_nonce(32);
+    try {
+        connection.endpoint =
+            host_override(cached.peer_port)
+                .value_or(udp::endpoint(
+                    asio::ip::make_address(cached.peer_ip), cached.peer_port));
+        connection.channel = SecureChannel(
+            derive_resumption_keys(cached.resumption_secret, receiver_nonce,
+                                   true),
+            token, Handshake::to_aead_cipher(cached.cipher_suite));
+    } catch (const std::exception& e) {
+        std::cerr << "Unusable resumption ticket: " << e.what() << std::endl;
+        co_return TransferOutcome::Unanswered;
+    }
+
+    hello->set_version(zapshare::v1::PROTOCOL_VERSION_1);
+    hello->set_transfer_id(token);
+    hello->set_ticket(cached.ticket);
+    hello->set_receiver_nonce(receiver_nonce);
+    std::string bytes;
+    if (!connection.channel.encode(build_get_request(token),
+                                   hello->mutable_early_data()) ||
+        !packet.SerializeToString(&bytes)) {
+        co_return TransferOutcome::Unanswered;
+    }
+
+    std::cout << "Resuming session with "
+              << connection.endpoint.address().to_string() << ":"
+              << connection.endpoint.port() << std::endl;
+    co_return co_await receive_file(
+        receiver, socket, connection, token, output_filename, cached.file_hash,
+        [&] {
+            asio::error_code ec;
+            socket.send_to(asio::buffer(bytes), connection.endpoint, 0, ec);
+        },
+        Resumption::RESUME_RETRIES);
+}
+#endif
+
+// Full handshake with whichever sender candidate answers first, then the
+// transfer from it. A sender reached without NAT in between needs no
+// `hole_punch`.
+asio::awaitable<TransferOutcome> connect_and_receive(
+    DatagramReceiver& receiver, Transport::Socket& socket, const TRANSFERS& t,
+    const std::string& token, const std::string& output_filename,
+    bool secure_transport, bool hole_punch = true) {
+    std::vector<udp::endpoint> peers = build_peer_candidates(t);
+
+    if (hole_punch) {
+        PublicEndpoint sender_ep;
+        sender_ep.ip = t.sender_ip;
+        sender_ep.port = static_cast<uint16_t>(t.sender_port);
+        sender_ep.local_ip = t.sender_local_ip;
+        sender_ep.local_port = static_cast<uint16_t>(t.sender_local_port);
+        Utils::perform_udp_hole_punch(socket, sender_ep);
+    }
+
+    auto connected_peer = co_await perform_handshake(
+        receiver, socket, peers, token, secure_transport);
+
+    if (!connected_peer) {
+        std::cerr << "Failed to connect to peer." << std::endl;
+        co_return TransferOutcome::Failed;
+    }
+    std::cout << "Connected to "
+              << connected_peer->endpoint.address().to_string() << ":"
+              << connected_peer->endpoint.port()
+              << std::endl;
+    if (connected_peer->channel.is_secure()) {
+        std::cout << "Encrypted with "
+                  << Handshake::cipher_name(connected_peer->channel.cipher())
+                  << std::endl;
+    }
+
+    if (connected_peer->ticket) {
+        connected_peer->ticket->file_name = t.file_name;
+        connected_peer->ticket->file_hash = t.file_hash;
+        Resumption::store_ticket(token, *connected_peer->ticket);
+    }
+
+    const zapshare::v1::ControlPacket get_request = build_get_request(token);
+    SecureChannel& channel = connected_peer->channel;
+    const udp::endpoint& peer = connected_peer->endpoint;
+    co_return co_await receive_file(
+        receiver, socket, *connected_peer, token, output_filename, t.file_hash,
+        [&] { send_control(socket, peer, channel, get_request); });
+}
+
+// Encrypted data path unless explicitly turned off for debugging
+bool secure_transport_from_env() {
+    return std::getenv("ZAPSHARE_INSECURE") == nullptr;
+}
+
+// Runs one client coroutine on `io` with `receiver` armed, until it is
+// done. Exceptions it throws come out here.
+TransferOutcome run_to_completion(asio::io_context& io,
+                                  DatagramReceiver& receiver,
+                                  asio::awaitable<TransferOutcome> flow) {
+    TransferOutcome outcome = TransferOutcome::Failed;
+    std::exception_ptr error;
+    bool finished = false;
+    io.restart();
+    asio::co_spawn(io, std::move(flow),
+                   [&](std::exception_ptr e, TransferOutcome result) {
+                       error = e;
+                       outcome = result;
+                       finished = true;
+                       receiver.stop();
+                   });
+#ifdef ZAPSHARE_SIMULATION
+    // The simulated sender shares the io_context and never runs out of
+    // work, so stop at our own end instead
+    Sim::run(io, [&] { return finished; });
+#else
+    io.run();
+#endif
+    if (error) std::rethrow_exception(error);
+    return outcome;
 }
 
 }  // namespace
 
+bool receive_via(asio::io_context& io, Transport::Socket& socket,
+                 const TRANSFERS& transfer,
+                 const std::string& output_filename) {
+    DatagramReceiver receiver(io, socket);
+    return run_to_completion(
+               io, receiver,
+               connect_and_receive(receiver, socket, transfer, transfer.id,
+                                   output_filename,
+                                   secure_transport_from_env(), false)) ==
+           TransferOutcome::Complete;
+}
+
+#ifndef ZAPSHARE_SIMULATION
 bool run_client_session(const std::string& token,
                         const std::string& output_filename) {
     asio::io_context io;
@@ -262,31 +707,51 @@ bool run_client_session(const std::string& token,
     socket.open(udp::v4());
     socket.bind(udp::endpoint(udp::v4(), 0));
 
+    const bool secure_transport = secure_transport_from_env();
+
+    if (secure_transport) {
+        if (auto cached = Resumption::load_ticket(token)) {
+            DatagramReceiver receiver(io, socket);
+            switch (run_to_completion(
+                io, receiver,
+                resume_transfer(receiver, socket, token, *cached,
+                                output_filename))) {
+                case TransferOutcome::Complete:
+                    return true;
+                case TransferOutcome::Failed:
+                    return false;
+                case TransferOutcome::Unanswered:
+                    std::cout << "Resumption failed, falling back to a full "
+                                 "handshake."
+                              << std::endl;
+                    Resumption::forget_ticket(token);
+                    break;
+            }
+        }
+    }
+
     PublicEndpoint my_ep = Utils::get_public_endpoint_for_socket(io, socket);
 
     Utils::signal_receiver_endpoint(token, my_ep);
 
     TRANSFERS t = Utils::get_transfer_metadata(token);
-    std::vector<udp::endpoint> peers = build_peer_candidates(t);
-
-    PublicEndpoint sender_ep;
-    sender_ep.ip = t.sender_ip;
-    sender_ep.port = static_cast<uint16_t>(t.sender_port);
-    sender_ep.local_ip = t.sender_local_ip;
-    sender_ep.local_port = static_cast<uint16_t>(t.sender_local_port);
-
-    auto connected_peer =
-        perform_handshake(io, socket, peers, sender_ep, token);
-
-    if (!connected_peer) {
-        std::cerr << "Failed to connect to peer." << std::endl;
-        return false;
-    }
-    std::cout << "Connected to " << connected_peer->address().to_string() << ":"
-              << connected_peer->port() << std::endl;
-
-    const std::string get_bytes = build_get_request(token);
+    apply_host_override(t);
+
+    // Armed from here to the end; STUN above read the socket directly
+    DatagramReceiver receiver(io, socket);
+    return run_to_completion(io, receiver,
+                             connect_and_receive(receiver, socket, t, token,
+                                                 output_filename,
+                                                 secure_transport)) ==
+           TransferOutcome::Complete;
+}
 
-    return receive_file(io, socket, *connected_peer, token, output_filename,
-                        t.file_hash, get_bytes);
+bool receive_direct(const TRANSFERS& transfer,
+                    const std::string& output_filename) {
+    asio::io_context io;
+    udp::socket socket(io);
+    socket.open(udp::v4());
+    socket.bind(udp::endpoint(udp::v4(), 0));
+    return receive_via(io, socket, transfer, output_filename);
 }
+#endif
@@ -0,0 +1,379 @@
+#include "daemon.hpp"
+
+#include <sys/stat.h>
+
+#include <asio.hpp>
+#include <cstdlib>
+#include <iostream>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "crypto.hpp"
+#include "keys.hpp"
+#include "server.hpp"
+#include "trace.hpp"
+#include "types.h"
+#include "utils.hpp"
+
+using json = nlohmann::json;
+using stream_protocol = asio::local::stream_protocol;
+
+namespace Daemon {
+
+namespace {
+
+std::chrono::seconds transfer_ttl_from_env() {
+    const char* env = std::getenv("ZAPSHARE_TRANSFER_TTL_SECS");
+    return env ? std::chrono::seconds(std::strtol(env, nullptr, 10))
+               : DEFAULT_TRANSFER_TTL;
+}
+
+json error_reply(const std::string& message) {
+    return {{"ok", false}, {"error", message}};
+}
+
+// Hashing dominates offering a large file. An unchanged file (same size
+// and modification time) reuses the hash from last time.
+class HashCache {
+   public:
+    std::string hash(const std::filesystem::path& path) {
+        const uintmax_t size = std::filesystem::file_size(path);
+        const auto modified = std::filesystem::last_write_time(path);
+        auto it = m_entries.find(path.string());
+        if (it != m_entries.end() && it->second.size == size &&
+            it->second.modified == modified) {
+            return it->second.hash;
+        }
+        std::string hash = Crypto::compute_file_hash(path.string());
+        m_entries[path.string()] = {size, modified, hash};
+        return hash;
+    }
+
+   private:
+    struct Entry {
+        uintmax_t size;
+        std::filesystem::file_time_type modified;
+        std::string hash;
+    };
+    std::unordered_map<std::string, Entry> m_entries;
+};
+
+// Carries out control requests. Runs on the control thread only.
+class Controller {
+   public:
+    explicit Controller(Server& server)
+        : m_server(server), m_ttl(transfer_ttl_from_env()) {}
+
+    json handle(const json& request) {
+        const std::string command = request.value("command", "");
+        try {
+            if (command == "send") return send(request);
+            if (command == "list") return list();
+            if (command == "cancel") return cancel(request);
+            if (command == "trace") return trace(request);
+            if (command == "stop") {
+                m_stopping = true;
+                return {{"ok", true}};
+            }
+        } catch (const std::exception& e) {
+            return error_reply(e.what());
+        }
+        return error_reply("Unknown command: " + command);
+    }
+
+    // A stop takes effect once its reply is out, so the caller hears back
+    bool stopping() const { return m_stopping; }
+    void shutdown() { m_server.shutdown(); }
+
+   private:
+    json send(const json& request) {
+        const std::filesystem::path path = request.value("path", "");
+        if (path.is_relative() || !Utils::check_file_exists(path.string())) {
+            return error_reply("Invalid filepath");
+        }
+        TRANSFERS transfer =
+            Utils::new_transfer(path.string(), m_hashes.hash(path));
+        transfer.sender_ip = public_ip();
+        if (!m_server.add_transfer(path.string(), transfer,
+                                   request.value("max_receivers", 0u),
+                                   m_ttl)) {
+            return error_reply("Failed to open file");
+        }
+        Utils::register_transfer(transfer);
+        std::cout << "Offering " << path.string() << " as " << transfer.id
+                  << std::endl;
+        return {{"ok", true}, {"secret", transfer.id}};
+    }
+
+    json list() {
+        json transfers = json::array();
+        for (const auto& served : m_server.transfers()) {
+            transfers.push_back(
+                {{"secret", served->transfer.id},
+                 {"file_name", served->transfer.file_name},
+                 {"file_size", served->transfer.file_size},
+                 {"receivers_started", served->receivers_started.load()},
+                 {"receivers_completed",
+                  served->receivers_completed.load()}});
+        }
+        return {{"ok", true}, {"transfers", transfers}};
+    }
+
+    json cancel(const json& request) {
+        if (!m_server.remove_transfer(request.value("secret", ""))) {
+            return error_reply("No such transfer");
+        }
+        return {{"ok", true}};
+    }
+
+    // An empty path turns tracing off
+    json trace(const json& request) {
+        const std::string path = request.value("path", "");
+        if (path.empty()) {
+            Trace::stop();
+        } else if (!Trace::start(path)) {
+            return error_reply("Cannot write a trace to " + path);
+        }
+        return {{"ok", true}};
+    }
+
+    // The STUN lookup is repeated only once the cached answer is stale
+    std::string public_ip() {
+        const auto now = std::chrono::steady_clock::now();
+        if (m_public_ip.empty() || now - m_public_ip_at >= STUN_REFRESH) {
+            try {
+                m_public_ip = Utils::get_public_endpoint().ip;
+                std::cout << "Public endpoint: " << m_public_ip << std::endl;
+            } catch (const std::exception& e) {
+                std::cerr << "NAT traversal failed: " << e.what() << std::endl;
+                m_public_ip = "127.0.0.1";
+            }
+            m_public_ip_at = now;
+        }
+        return m_public_ip;
+    }
+
+    Server& m_server;
+    const std::chrono::seconds m_ttl;
+    HashCache m_hashes;
+    bool m_stopping = false;
+    std::string m_public_ip;
+    std::chrono::steady_clock::time_point m_public_ip_at;
+};
+
+// One request line in, one reply line out, then the connection closes.
+class ControlConnection
+    : public std::enable_shared_from_this<ControlConnection> {
+   public:
+    ControlConnection(stream_protocol::socket socket, Controller& controller)
+        : m_socket(std::move(socket)),
+          m_buffer(MAX_REQUEST_BYTES),
+          m_controller(controller) {}
+
+    void start() {
+        asio::async_read_until(
+            m_socket, m_buffer, '\n',
+            [self = shared_from_this()](asio::error_code ec, size_t) {
+                if (ec) return;
+                std::istream stream(&self->m_buffer);
+                std::string line;
+                std::getline(stream, line);
+                const json request = json::parse(line, nullptr, false);
+                self->reply(request.is_discarded()
+                                ? error_reply("Malformed request")
+                                : self->m_controller.handle(request));
+            });
+    }
+
+   private:
+    void reply(const json& response) {
+        m_reply = response.dump() + "\n";
+        asio::async_write(m_socket, asio::buffer(m_reply),
+                          [self = shared_from_this()](asio::error_code,
+                                                      size_t) {
+                              if (self->m_controller.stopping()) {
+                                  self->m_controller.shutdown();
+                              }
+                          });
+    }
+
+    stream_protocol::socket m_socket;
+    asio::streambuf m_buffer;
+    std::string m_reply;
+    Controller& m_controller;
+};
+
+class ControlServer {
+   public:
+    ControlServer(asio::io_context& io, Controller& controller)
+        : m_acceptor(io), m_controller(controller) {}
+
+    // Only the owner may talk to the daemon: a request can make it serve
+    // any file the owner can read.
+    bool listen(const std::filesystem::path& path) {
+        if (request({{"command", "list"}})) {
+            std::cerr << "A zapshare daemon is already running on "
+                      << path.string() << std::endl;
+            return false;
+        }
+        std::error_code ec;
+        const std::filesystem::path dir = path.parent_path();
+        if (!dir.empty() && !std::filesystem::exists(dir, ec)) {
+            std::filesystem::create_directories(dir, ec);
+            std::filesystem::permissions(
+                dir, std::filesystem::perms::owner_all, ec);
+        }
+        std::filesystem::remove(path, ec);  // Left behind by a crash
+        try {
+            m_acceptor.open(stream_protocol());
+            // Created owner-only, so it is never open to anyone else
+            asio::error_code bind_error;
+            const mode_t umask = ::umask(S_IRWXG | S_IRWXO);
+            m_acceptor.bind(stream_protocol::endpoint(path.string()),
+                            bind_error);
+            ::umask(umask);
+            if (bind_error) throw std::runtime_error(bind_error.message());
+            ::chmod(path.c_str(), S_IRUSR | S_IWUSR);
+            m_acceptor.listen();
+        } catch (const std::exception& e) {
+            std::cerr << "Failed to open control socket " << path.string()
+                      << ": " << e.what() << std::endl;
+            return false;
+        }
+        accept();
+        return true;
+    }
+
+   private:
+    void accept() {
+        m_acceptor.async_accept(
+            [this](asio::error_code ec, stream_protocol::socket socket) {
+                if (ec) return;
+                std::make_shared<ControlConnection>(std::move(socket),
+                                                    m_controller)
+                    ->start();
+                accept();
+            });
+    }
+
+    stream_protocol::acceptor m_acceptor;
+    Controller& m_controller;
+};
+
+}  // namespace
+
+std::filesystem::path socket_path() {
+    if (const char* path = std::getenv("ZAPSHARE_DAEMON_SOCKET")) return path;
+    if (const char* home = std::getenv("HOME")) {
+        return std::filesystem::path(home) / ".cache/zapshare/daemon.sock";
+    }
+    return "zapshare_daemon.sock";
+}
+
+std::optional<json> request(const json& command) {
+    try {
+        asio::io_context io;
+        stream_protocol::socket socket(io);
+        socket.connect(stream_protocol::endpoint(socket_path().string()));
+        asio::write(socket, asio::buffer(command.dump() + "\n"));
+        asio::streambuf buffer(MAX_REQUEST_BYTES);
+        asio::read_until(socket, buffer, '\n');
+        std::istream stream(&buffer);
+        std::string line;
+        std::getline(stream, line);
+        return json::parse(line);
+    } catch (const std::exception&) {
+        return std::nullopt;
+    }
+}
+
+std::optional<std::string> offer(const std::string& file_path) {
+    json command = {
+        {"command", "send"},
+        {"path", std::filesystem::absolute(file_path).string()}};
+    if (const char* env = std::getenv("ZAPSHARE_MAX_RECEIVERS")) {
+        command["max_receivers"] = std::strtoul(env, nullptr, 10);
+    }
+    const std::optional<json> reply = request(command);
+    if (!reply) return std::nullopt;
+    if (!reply->value("ok", false)) {
+        throw std::runtime_error(reply->value("error", "Daemon refused"));
+    }
+    return reply->value("secret", "");
+}
+
+int run() {
+    Keys::start_ephemeral_pool();
+    asio::io_context io;
+    Server server(io, Utils::DEFAULT_PORT, true);
+    Controller controller(server);
+
+    // Control requests (hashing, STUN, registration) are slow next to the
+    // transfers, so they get their own thread.
+    asio::io_context control_io;
+    ControlServer control(control_io, controller);
+    const std::filesystem::path path = socket_path();
+    if (!control.listen(path)) return 1;
+
+    server.run();
+    std::thread control_thread([&control_io] { control_io.run(); });
+    std::cout << "zapshare daemon listening on " << path.string() << std::endl;
+    io.run();
+
+    control_io.stop();
+    control_thread.join();
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    return 0;
+}
+
+int control(const std::vector<std::string>& args) {
+    const std::string& action = args.at(0);
+    json command = {{"command", action}};
+    if (action == "cancel") {
+        if (args.size() < 2) {
+            std::cerr << "usage: zapshare daemon cancel [secret]\n";
+            return 1;
+        }
+        command["secret"] = args[1];
+    } else if (action == "trace") {
+        if (args.size() < 2) {
+            std::cerr << "usage: zapshare daemon trace [path|off]\n";
+            return 1;
+        }
+        // The daemon runs elsewhere, so it gets an absolute path
+        command["path"] = args[1] == "off"
+                              ? ""
+                              : std::filesystem::absolute(args[1]).string();
+    } else if (action != "list" && action != "stop") {
+        std::cerr << "Unknown daemon command: " << action << "\n";
+        return 1;
+    }
+
+    const std::optional<json> reply = request(command);
+    if (!reply) {
+        std::cerr << "No zapshare daemon running on "
+                  << socket_path().string() << std::endl;
+        return 1;
+    }
+    if (!reply->value("ok", false)) {
+        std::cerr << reply->value("error", "Request failed") << std::endl;
+        return 1;
+    }
+    if (action == "list") {
+        for (const json& transfer : (*reply)["transfers"]) {
+            std::cout << transfer.value("secret", "") << "  "
+                      << transfer.value("file_name", "") << "  "
+                      << transfer.value("file_size", 0ull) << " bytes  "
+                      << transfer.value("receivers_completed", 0u) << "/"
+                      << transfer.value("receivers_started", 0u)
+                      << " receivers done" << std::endl;
+        }
+    }
+    return 0;
+}
+
+}  // namespace Daemon
@@ -1,62 +1,473 @@
 #include "server.hpp"
 
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <system_error>
 
 #include "session.hpp"
 #include "utils.hpp"
 
-Server::Server(asio::io_context& io_context, short port, const std::string& file_path)
-    : m_Initialized(false), m_socket(io_context, asio::ip::udp::endpoint(asio::ip::udp::v4(), port)), m_file_path(file_path) {
+namespace {
+
+// ZAPSHARE_LINGER_SECS keeps the sender up for late receivers once the last
+// transfer ends; the default exits as soon as it is done.
+std::chrono::seconds linger_from_env() {
+    const char* env = std::getenv("ZAPSHARE_LINGER_SECS");
+    return std::chrono::seconds(env ? std::strtol(env, nullptr, 10) : 0);
 }
 
-Server::~Server() { std::cout << "Your file was transfered successfully\n"; }
+// ZAPSHARE_FANOUT turns on fan-out mode: receivers share one read cache of
+// ZAPSHARE_FANOUT_CACHE_MB (default 256 MiB) so the file is read once for
+// all of them.
+constexpr size_t FANOUT_CACHE_MB = 256;
+constexpr size_t FANOUT_READ_AHEAD_BLOCKS = 8;
 
-void Server::run(const std::string& transfer_id) {
-    m_Initialized = true;
-    
-    // 1. Poll for signal
-    std::cout << "Polling for peer signal..." << std::endl;
-    PublicEndpoint peer_ep = Utils::poll_for_signal(transfer_id);
-    m_remote_endpoint = asio::ip::udp::endpoint(asio::ip::make_address(peer_ep.ip), peer_ep.port);
-    std::cout << "Peer signal received: " << peer_ep.ip << ":" << peer_ep.port << std::endl;
-
-    // 2. Punch hole
-    std::cout << "Punching hole to peer..." << std::endl;
-    Utils::perform_udp_hole_punch(m_socket, peer_ep);
-    
-    // 3. Create Session and Start Receive Loop
-    m_session = std::make_shared<Session>(m_socket, m_remote_endpoint, m_file_path);
-    m_session->start();
-    
-    do_receive(); 
-}
-
-void Server::do_receive() {
-    auto buffer = std::make_shared<std::array<char, UdpConfig::MAX_PACKET_SIZE>>();
-    // Receive from anyone, but handle_packet filters
-    asio::ip::udp::endpoint sender_endpoint;
-    
-    // Using a member for receive_endpoint or local one? local is fine for lambda capture
-    // but async_receive_from needs a reference that stays alive.
-    // Let's allocation sender endpoint on heap or use member if we want.
-    // However, for the lambda, we can capture a shared_ptr to an endpoint?
-    auto sender_ptr = std::make_shared<asio::ip::udp::endpoint>();
+size_t fanout_cache_blocks() {
+    const char* enabled = std::getenv("ZAPSHARE_FANOUT");
+    if (!enabled || std::string(enabled) == "0") return 0;
+    const char* env = std::getenv("ZAPSHARE_FANOUT_CACHE_MB");
+    const size_t mb = env ? std::strtoul(env, nullptr, 10) : FANOUT_CACHE_MB;
+    return mb * (1 << 20) / ChunkCache::BLOCK_SIZE;
+}
+
+// ZAPSHARE_SHARDS=N runs N shards; "auto" runs one per core.
+size_t shards_from_env() {
+    const char* env = std::getenv("ZAPSHARE_SHARDS");
+    if (!env) return 1;
+    const size_t shards =
+        std::string(env) == "auto" ? std::thread::hardware_concurrency() : std::strtoul(env, nullptr, 10);
+    return std::clamp<size_t>(shards, 1, Server::MAX_SHARDS);
+}
+
+constexpr uint64_t SHARD_MASK = Server::MAX_SHARDS - 1;
+
+asio::ip::udp::socket open_socket(asio::io_context& io_context, short port, bool reuse_port) {
+    asio::ip::udp::socket socket(io_context, asio::ip::udp::v4());
+    if (reuse_port) {
+        const int enable = 1;
+        if (::setsockopt(socket.native_handle(), SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) != 0) {
+            throw std::system_error(errno, std::generic_category(), "SO_REUSEPORT");
+        }
+    }
+    socket.bind(asio::ip::udp::endpoint(asio::ip::udp::v4(), port));
+    return socket;
+}
+
+// Pins the calling thread to the nth CPU it may run on, so a shard's
+// socket, sessions and caches stay on one core.
+void pin_to_core(size_t n) {
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(allowed), &allowed) != 0) return;
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+    }
+    if (cpus.empty()) return;
+    cpu_set_t pinned;
+    CPU_ZERO(&pinned);
+    CPU_SET(cpus[n % cpus.size()], &pinned);
+    pthread_setaffinity_np(pthread_self(), sizeof(pinned), &pinned);
+#endif
+}
+
+// Only a hello may open a session; stray datagrams such as a receiver's
+// hole punches must not take a slot.
+bool opens_session(std::string_view data) {
+    zapshare::v1::HandshakePacket packet;
+    return packet.ParseFromArray(data.data(), static_cast<int>(data.size())) &&
+           (packet.has_client_hello() || packet.has_resume_hello());
+}
+
+}  // namespace
+
+ServerShard::ServerShard(Server& server, asio::io_context& io_context, size_t index, short port, bool reuse_port,
+                         const SenderContext& shared, size_t crypto_threads)
+    : m_server(server),
+      m_index(index),
+      m_socket(open_socket(io_context, port, reuse_port)),
+      m_check_timer(io_context),
+      m_pipeline(std::make_unique<CryptoPipeline>(io_context.get_executor(), crypto_threads)),
+      m_context(shared) {
+    m_context.pipeline = m_pipeline.get();
+    m_context.on_authenticated = [this](Session& session) { session_authenticated(session); };
+    m_context.on_transferring = [this](Session& session) { session_transferring(session); };
+    m_context.on_moved = [this](Session& session, const asio::ip::udp::endpoint& previous) {
+        session_moved(session, previous);
+    };
+    m_context.on_closed = [this](Session& session, bool completed) { session_ended(session, completed); };
+}
+
+void ServerShard::start() {
+    schedule_check();
+    do_receive();
+}
+
+// Closing the sessions ends their coroutines, so nothing is left holding the
+// io_context open.
+void ServerShard::stop() {
+    asio::post(m_socket.get_executor(), [this] {
+        m_stopped = true;
+        m_check_timer.cancel();
+        asio::error_code ec;
+        m_socket.cancel(ec);
+        std::vector<asio::ip::udp::endpoint> endpoints;
+        for (const auto& [endpoint, session] : m_sessions) endpoints.push_back(endpoint);
+        for (const auto& endpoint : endpoints) erase_session(endpoint, false);
+    });
+}
+
+// Each datagram lands in a pooled buffer that is handed on as is, so once
+// the pool has warmed up receiving allocates nothing.
+void ServerShard::do_receive() {
+    ReceiveBuffer::Ptr datagram = m_pool.acquire();
+    ReceiveBuffer& buffer = *datagram;
 
     m_socket.async_receive_from(
-        asio::buffer(*buffer), *sender_ptr,
-        [this, buffer, sender_ptr](asio::error_code ec, std::size_t bytes_recvd) {
+        buffer.storage(), buffer.sender,
+        [this, datagram = std::move(datagram)](asio::error_code ec, std::size_t bytes_recvd) mutable {
             if (!ec && bytes_recvd > 0) {
-               std::string data(buffer->data(), bytes_recvd);
-               if (m_session) {
-                   m_session->handle_packet(data, *sender_ptr);
-                   if (m_session->is_closed()) return; 
-               }
+                datagram->set_size(bytes_recvd);
+                dispatch(std::move(datagram));
             } else if (ec != asio::error::operation_aborted) {
                 std::cerr << "Receive error: " << ec.message() << std::endl;
             }
-            
-            if (!ec || ec == asio::error::connection_reset) { // Continue on success or connection_reset (UDP ICMP)
-                 do_receive();
+            if (m_stopped) return;
+
+            if (!ec || ec == asio::error::connection_reset) {  // Continue on success or connection_reset (UDP ICMP)
+                do_receive();
+            }
+        });
+}
+
+// Hands the datagram to its session's coroutine, opening a session for a
+// new receiver's hello.
+void ServerShard::dispatch(ReceiveBuffer::Ptr datagram) {
+    const asio::ip::udp::endpoint sender = datagram->sender;
+    auto it = m_sessions.find(sender);
+    if (it == m_sessions.end()) {
+        if (!opens_session(datagram->view())) {
+            route_by_connection_id(std::move(datagram));
+            return;
+        }
+        if (m_sessions.size() >= Server::MAX_SESSIONS) return;
+        const uint64_t connection_id = next_connection_id();
+        auto session = std::make_shared<Session>(m_socket, sender, m_context, connection_id);
+        it = m_sessions.emplace(sender, session).first;
+        m_connections.emplace(connection_id, session);
+        m_server.session_opened();
+        session->deliver(std::move(datagram));
+        session->start();
+        return;
+    }
+    it->second->deliver(std::move(datagram));
+}
+
+// Off the hot path: only datagrams from an address with no session here get
+// parsed for a connection ID.
+void ServerShard::route_by_connection_id(ReceiveBuffer::Ptr datagram) {
+    const std::string_view data = datagram->view();
+    zapshare::v1::SecurePacket wire;
+    if (!wire.ParseFromArray(data.data(), static_cast<int>(data.size())) || wire.connection_id() == 0) return;
+    const uint64_t connection_id = wire.connection_id();
+    const size_t owner = connection_id & SHARD_MASK;
+    if (owner >= m_server.m_shards.size()) return;
+
+    if (owner != m_index) {
+        m_server.m_shards[owner]->route(connection_id, std::move(datagram));
+        return;
+    }
+    auto it = m_connections.find(connection_id);
+    if (it != m_connections.end()) it->second->deliver(std::move(datagram));
+}
+
+// The buffer stays with the shard that received it and goes back to its
+// pool from here once handled.
+void ServerShard::route(uint64_t connection_id, ReceiveBuffer::Ptr datagram) {
+    asio::post(m_socket.get_executor(), [this, connection_id, datagram = std::move(datagram)]() mutable {
+        if (m_stopped) return;
+        auto it = m_connections.find(connection_id);
+        if (it != m_connections.end()) it->second->deliver(std::move(datagram));
+    });
+}
+
+// A receiver hellos every sender candidate, so it can open a session per
+// path, possibly on other shards. It only uses the one it started
+// transferring on; the others would just sit there until the idle timeout.
+void ServerShard::session_authenticated(Session& session) {
+    if (m_server.is_claimed_elsewhere(session)) erase_session(session.remote_endpoint(), false);
+}
+
+void ServerShard::session_transferring(Session& session) {
+    m_server.claim_hello(session);
+    for (auto& shard : m_server.m_shards) shard->drop_duplicates(session.hello_nonce(), session.remote_endpoint());
+}
+
+void ServerShard::session_moved(Session& session, const asio::ip::udp::endpoint& previous) {
+    auto it = m_sessions.find(previous);
+    if (it == m_sessions.end() || it->second.get() != &session) return;
+    std::shared_ptr<Session> moved = std::move(it->second);
+    m_sessions.erase(it);
+    // Whatever held the new address before is stale
+    erase_session(session.remote_endpoint(), false);
+    m_sessions.emplace(session.remote_endpoint(), std::move(moved));
+}
+
+// The session may already be gone from the table, and its address taken by
+// a newer one. Only a receiver that got the whole file counts as finished.
+void ServerShard::session_ended(Session& session, bool completed) {
+    auto it = m_sessions.find(session.remote_endpoint());
+    if (it != m_sessions.end() && it->second.get() == &session) erase_session(it->first, completed);
+}
+
+void ServerShard::drop_duplicates(std::string hello_nonce, asio::ip::udp::endpoint keep) {
+    asio::post(m_socket.get_executor(), [this, hello_nonce = std::move(hello_nonce), keep] {
+        std::vector<asio::ip::udp::endpoint> duplicates;
+        for (const auto& [endpoint, session] : m_sessions) {
+            if (endpoint != keep && !session->is_transferring() && session->hello_nonce() == hello_nonce) {
+                duplicates.push_back(endpoint);
+            }
+        }
+        for (const auto& endpoint : duplicates) erase_session(endpoint, false);
+    });
+}
+
+void ServerShard::erase_session(const asio::ip::udp::endpoint& endpoint, bool finished) {
+    auto it = m_sessions.find(endpoint);
+    if (it == m_sessions.end()) return;
+    const std::shared_ptr<Session> session = std::move(it->second);
+    m_sessions.erase(it);
+    m_connections.erase(session->connection_id());
+    m_server.release_hello(*session);
+    session->close();
+    m_server.session_closed(finished);
+}
+
+uint64_t ServerShard::next_connection_id() const {
+    uint64_t connection_id = 0;
+    while (connection_id == 0 || m_connections.count(connection_id)) {
+        const std::string random = random_nonce(sizeof(connection_id));
+        std::memcpy(&connection_id, random.data(), sizeof(connection_id));
+        connection_id = (connection_id & ~SHARD_MASK) | m_index;
+    }
+    return connection_id;
+}
+
+// Sessions time themselves out; this only decides when the sender is done.
+void ServerShard::schedule_check() {
+    m_check_timer.expires_after(std::chrono::seconds(1));
+    m_check_timer.async_wait([this](asio::error_code ec) {
+        if (ec || m_stopped) return;
+        m_server.check_done();
+        if (!m_stopped) schedule_check();
+    });
+}
+
+Server::Server(asio::io_context& io_context, short port, bool daemon)
+    : m_Initialized(false),
+      m_daemon(daemon),
+      m_idle_since(std::chrono::steady_clock::now()),
+      m_linger(linger_from_env()) {
+    m_context.find_transfer = [this](const std::string& id) { return find_transfer(id); };
+    m_context.tickets = &m_tickets;
+    m_sampler = Telemetry::Sampler::from_env();
+    m_context.sampler = m_sampler.get();
+
+    const size_t shards = shards_from_env();
+    const bool sharded = shards > 1;
+    // The shards are the parallelism: unless told otherwise each one seals
+    // on its own thread rather than adding a crypto pool per shard.
+    const size_t crypto_threads =
+        sharded && !std::getenv("ZAPSHARE_CRYPTO_THREADS") ? 0 : CryptoPipeline::default_thread_count();
+    for (size_t i = 0; i < shards; ++i) {
+        asio::io_context* shard_context = &io_context;
+        if (i > 0) {
+            m_shard_contexts.push_back(std::make_unique<asio::io_context>(1));
+            shard_context = m_shard_contexts.back().get();
+        }
+        m_shards.push_back(
+            std::make_unique<ServerShard>(*this, *shard_context, i, port, sharded, m_context, crypto_threads));
+    }
+    if (sharded) std::cout << "Sharded sender: " << shards << " sockets on port " << port << std::endl;
+}
+
+Server::~Server() {
+    stop();
+    for (std::thread& thread : m_shard_threads) thread.join();
+    {
+        std::lock_guard<std::mutex> lock(m_signal_mutex);
+        m_signal_stopping = true;
+    }
+    m_signal_cv.notify_all();
+    if (m_signal_thread.joinable()) m_signal_thread.join();
+    for (const auto& [id, served] : m_transfers) {
+        if (!served->cache) continue;
+        const ChunkCache::Stats stats = served->cache->stats();
+        std::cout << "Fan-out cache: " << stats.blocks_loaded << " blocks read from disk, " << stats.direct_reads
+                  << " direct reads, " << stats.throttle_waits << " throttle waits" << std::endl;
+    }
+    if (m_sessions_finished > 0 && !m_daemon) std::cout << "Your file was transfered successfully\n";
+}
+
+void Server::run() {
+    m_Initialized = true;
+    m_started_at = std::chrono::steady_clock::now();
+
+    // Receivers are hole-punched as their signals arrive; sessions are
+    // created by their first hello.
+    std::cout << "Polling for peer signal..." << std::endl;
+    m_signal_thread = std::thread([this] { watch_signals(); });
+
+    for (auto& shard : m_shards) shard->start();
+    for (size_t i = 1; i < m_shards.size(); ++i) {
+        m_shard_threads.emplace_back([this, i] {
+            pin_to_core(i);
+            try {
+                m_shard_contexts[i - 1]->run();
+            } catch (const std::exception& e) {
+                std::cerr << "Shard " << i << " failed: " << e.what() << std::endl;
+                stop();
             }
         });
+    }
+    // Shard 0 runs on the caller's thread
+    if (m_shards.size() > 1) pin_to_core(0);
+}
+
+bool Server::add_transfer(const std::string& file_path, const TRANSFERS& transfer, uint32_t max_receivers,
+                          std::chrono::seconds ttl) {
+    auto served = std::make_shared<ServedFile>();
+    served->file = SourceFile::open(file_path);
+    if (!served->file) return false;
+    served->transfer = transfer;
+    served->max_receivers = max_receivers;
+    if (ttl.count() > 0) served->expires_at = std::chrono::steady_clock::now() + ttl;
+    if (const size_t blocks = fanout_cache_blocks(); blocks > 0) {
+        served->cache = std::make_unique<ChunkCache>(served->file, blocks, FANOUT_READ_AHEAD_BLOCKS);
+        std::cout << "Fan-out mode: " << (blocks * ChunkCache::BLOCK_SIZE >> 20) << " MiB shared read cache" << std::endl;
+    }
+    std::lock_guard<std::mutex> lock(m_transfers_mutex);
+    m_transfers[transfer.id] = std::move(served);
+    return true;
+}
+
+bool Server::remove_transfer(const std::string& id) {
+    std::lock_guard<std::mutex> lock(m_transfers_mutex);
+    return m_transfers.erase(id) > 0;
+}
+
+std::vector<std::shared_ptr<const ServedFile>> Server::transfers() {
+    std::lock_guard<std::mutex> lock(m_transfers_mutex);
+    std::vector<std::shared_ptr<const ServedFile>> result;
+    for (const auto& [id, served] : m_transfers) result.push_back(served);
+    return result;
+}
+
+std::shared_ptr<ServedFile> Server::find_transfer(const std::string& id) {
+    std::lock_guard<std::mutex> lock(m_transfers_mutex);
+    auto it = m_transfers.find(id);
+    if (it == m_transfers.end() || it->second->is_retired()) return nullptr;
+    return it->second;
+}
+
+void Server::retire_transfers() {
+    std::lock_guard<std::mutex> lock(m_transfers_mutex);
+    std::erase_if(m_transfers, [](const auto& entry) {
+        if (!entry.second->is_retired()) return false;
+        std::cout << "Transfer " << entry.first << " retired" << std::endl;
+        return true;
+    });
+}
+
+void Server::watch_signals() {
+    std::unordered_map<std::string, PublicEndpoint> last_signals;
+    asio::ip::udp::socket& socket = m_shards.front()->socket();
+    std::unique_lock<std::mutex> lock(m_signal_mutex);
+    while (!m_signal_stopping) {
+        lock.unlock();
+        std::vector<std::string> ids;
+        for (const auto& served : transfers()) ids.push_back(served->transfer.id);
+        std::erase_if(last_signals, [&](const auto& entry) {
+            return std::find(ids.begin(), ids.end(), entry.first) == ids.end();
+        });
+        for (const std::string& id : ids) {
+            std::optional<PublicEndpoint> signal = Utils::fetch_signal(id);
+            auto last = last_signals.find(id);
+            if (!signal || (last != last_signals.end() && last->second == *signal)) continue;
+            std::cout << "Peer signal received: " << signal->ip << ":" << signal->port << std::endl;
+            // Punches go out on the I/O thread, which owns the socket. Every
+            // shard shares the port, so any shard's socket will do.
+            for (int i = 0; i < 5; ++i) {
+                asio::post(socket.get_executor(), [&socket, peer = *signal] { Utils::send_udp_punch(socket, peer); });
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+            last_signals[id] = *signal;
+        }
+        lock.lock();
+        m_signal_cv.wait_for(lock, std::chrono::seconds(1), [this] { return m_signal_stopping; });
+    }
+}
+
+void Server::session_opened() {
+    ++m_sessions_started;
+    ++m_active_sessions;
+}
+
+void Server::session_closed(bool finished) {
+    const size_t active = --m_active_sessions;
+    m_idle_since = std::chrono::steady_clock::now();
+    if (!finished) return;
+    ++m_sessions_finished;
+    if (active == 0 && m_linger.count() == 0 && !m_daemon) stop();
+}
+
+void Server::claim_hello(const Session& session) {
+    std::lock_guard<std::mutex> lock(m_claims_mutex);
+    m_claimed_hellos.emplace(session.hello_nonce(), session.connection_id());
+}
+
+bool Server::is_claimed_elsewhere(const Session& session) {
+    std::lock_guard<std::mutex> lock(m_claims_mutex);
+    auto it = m_claimed_hellos.find(session.hello_nonce());
+    return it != m_claimed_hellos.end() && it->second != session.connection_id();
+}
+
+void Server::release_hello(const Session& session) {
+    std::lock_guard<std::mutex> lock(m_claims_mutex);
+    auto it = m_claimed_hellos.find(session.hello_nonce());
+    if (it != m_claimed_hellos.end() && it->second == session.connection_id()) m_claimed_hellos.erase(it);
+}
+
+// Runs on every shard's check tick
+void Server::check_done() {
+    if (m_daemon) {
+        retire_transfers();
+        return;
+    }
+    if (m_stopped || m_active_sessions > 0) return;
+    const auto now = std::chrono::steady_clock::now();
+    const auto give_up_after = std::max<std::chrono::seconds>(FIRST_PEER_TIMEOUT, m_linger);
+    if (m_sessions_finished > 0 && now - m_idle_since.load() >= m_linger) {
+        stop();
+    } else if (m_sessions_started == 0 && now - m_started_at >= give_up_after) {
+        std::cerr << "No Signal Received! Timed out" << std::endl;
+        stop();
+    } else if (m_sessions_finished == 0 && m_sessions_started > 0 && now - m_idle_since.load() >= give_up_after) {
+        // Receivers came and went without acking DONE. One may still have
+        // the whole file if only its final ack was lost, but nothing will
+        // tell us so now.
+        std::cerr << "No receiver confirmed the transfer! Timed out" << std::endl;
+        stop();
+    }
+}
+
+void Server::stop() {
+    if (m_stopped.exchange(true)) return;
+    for (auto& shard : m_shards) shard->stop();
 }
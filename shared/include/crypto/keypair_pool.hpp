@@ -0,0 +1,53 @@
+// Pool of pre-generated ephemeral key-exchange pairs, so a handshake pops
+// a ready key pair instead of generating one on its critical path.
+//
+// A background thread keeps the pool topped up. The pool itself is a
+// bounded lock-free MPMC ring (Vyukov's sequence-numbered cells): handshake
+// threads pop without taking a lock, and the refill thread sleeps on an
+// atomic wait until a pop makes room.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "crypto/session_crypto.hpp"
+
+class EphemeralKeyPool {
+   public:
+    explicit EphemeralKeyPool(size_t capacity = 64);
+    ~EphemeralKeyPool();
+
+    EphemeralKeyPool(const EphemeralKeyPool&) = delete;
+    EphemeralKeyPool& operator=(const EphemeralKeyPool&) = delete;
+
+    // Never blocks: falls back to generating inline when the pool has been
+    // drained faster than the refill thread can keep up.
+    EphemeralKeyPair take();
+
+    // Approximate, for diagnostics.
+    size_t available() const;
+
+   private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        EphemeralKeyPair key_pair;
+    };
+
+    bool try_push(EphemeralKeyPair&& key_pair);
+    bool try_pop(EphemeralKeyPair* key_pair);
+    void refill_loop();
+
+    const size_t m_capacity;  // Power of two
+    std::unique_ptr<Cell[]> m_cells;
+    alignas(64) std::atomic<size_t> m_enqueue_pos{0};
+    alignas(64) std::atomic<size_t> m_dequeue_pos{0};
+
+    // Bumped by every pop so the refill thread can wait for room.
+    alignas(64) std::atomic<uint32_t> m_pops{0};
+    std::atomic<bool> m_stopping{false};
+    std::thread m_refill_thread;
+};
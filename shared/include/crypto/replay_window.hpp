@@ -0,0 +1,59 @@
+// Sliding anti-replay window over packet sequence numbers, in the style of
+// IPsec/WireGuard. Sequences newer than the highest seen are always
+// accepted; older ones are accepted once while they are still inside the
+// window, so reordering is tolerated but duplicates are not.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+class ReplayWindow {
+   public:
+    static constexpr uint64_t WINDOW_SIZE = 1024;
+
+    // Cheap pre-check, done before spending time on decryption.
+    bool can_accept(uint64_t sequence) const {
+        if (!m_started || sequence > m_highest) return true;
+        if (m_highest - sequence >= WINDOW_SIZE) return false;
+        return !test(sequence);
+    }
+
+    // Records a sequence whose packet authenticated successfully.
+    void accept(uint64_t sequence) {
+        if (!m_started || sequence > m_highest) {
+            const uint64_t shift =
+                m_started ? sequence - m_highest : WINDOW_SIZE;
+            if (shift >= WINDOW_SIZE) {
+                m_bits.fill(0);
+            } else {
+                for (uint64_t s = m_highest + 1; s < sequence; ++s) clear(s);
+            }
+            m_highest = sequence;
+            m_started = true;
+        }
+        set(sequence);
+    }
+
+   private:
+    static constexpr size_t WORD_BITS = 64;
+
+    bool test(uint64_t sequence) const {
+        const uint64_t bit = sequence % WINDOW_SIZE;
+        return (m_bits[bit / WORD_BITS] >> (bit % WORD_BITS)) & 1;
+    }
+
+    void set(uint64_t sequence) {
+        const uint64_t bit = sequence % WINDOW_SIZE;
+        m_bits[bit / WORD_BITS] |= uint64_t{1} << (bit % WORD_BITS);
+    }
+
+    void clear(uint64_t sequence) {
+        const uint64_t bit = sequence % WINDOW_SIZE;
+        m_bits[bit / WORD_BITS] &= ~(uint64_t{1} << (bit % WORD_BITS));
+    }
+
+    std::array<uint64_t, WINDOW_SIZE / WORD_BITS> m_bits{};
+    uint64_t m_highest = 0;
+    bool m_started = false;
+};
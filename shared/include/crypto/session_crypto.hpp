@@ -1,7 +1,12 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <span>
 #include <string>
+#include <string_view>
 
 struct IdentityKeyPair {
     std::string public_key;
@@ -19,6 +24,11 @@ struct SessionKeys {
 };
 
 IdentityKeyPair generate_identity_keypair();
+
+// Loads the long-term identity stored at `path`, creating it (owner-only
+// permissions) on first use so peers see a stable public key across runs.
+IdentityKeyPair load_or_create_identity(const std::string& path);
+
 EphemeralKeyPair generate_ephemeral_keypair();
 std::string random_nonce(size_t size);
 
@@ -33,8 +43,67 @@ SessionKeys derive_client_keys(const EphemeralKeyPair& client_keypair,
 SessionKeys derive_server_keys(const EphemeralKeyPair& server_keypair,
                                const std::string& client_public_key);
 
+// Secret both ends of a full handshake derive from its session keys. The
+// sender hands its copy back inside a resumption ticket.
+std::string derive_resumption_secret(const SessionKeys& keys, bool is_client);
+
+// Keys for a resumed session. `receiver_nonce` must be fresh for every
+// resumption: it is all that keeps two resumptions of one ticket from
+// sharing keys.
+SessionKeys derive_resumption_keys(const std::string& resumption_secret,
+                                   const std::string& receiver_nonce,
+                                   bool is_client);
+
 std::string encrypt_packet(const std::string& plaintext, const std::string& key,
                            uint64_t sequence);
 
 bool decrypt_packet(const std::string& ciphertext, const std::string& key,
-                    uint64_t sequence, std::string* plaintext);
\ No newline at end of file
+                    uint64_t sequence, std::string* plaintext);
+
+// In-place AEAD for the data path. The nonce is derived from `sequence`, so
+// nothing but the tag goes on the wire. A (key, sequence) pair must never be
+// sealed twice; keys from derive_*_keys are per-direction, which keeps the
+// two ends from colliding. Neither call allocates.
+inline constexpr size_t AEAD_TAG_BYTES = 16;
+
+// Encrypts buffer[0, plaintext_len) in place and writes the tag right after
+// it, so `buffer` needs AEAD_TAG_BYTES of room past the plaintext. Returns
+// the sealed length.
+size_t seal_packet(std::span<char> buffer, size_t plaintext_len,
+                   std::string_view key, uint64_t sequence,
+                   std::string_view associated_data = {});
+
+// Verifies and decrypts a sealed buffer in place. On success the plaintext
+// occupies buffer[0, *plaintext_len).
+bool open_packet(std::span<char> buffer, std::string_view key,
+                 uint64_t sequence, size_t* plaintext_len,
+                 std::string_view associated_data = {});
+
+enum class AeadCipher { XChaCha20Poly1305, Aes256Gcm };
+
+// libsodium only offers AES-256-GCM where the CPU has AES and carry-less
+// multiply instructions, so this doubles as the hardware AES check.
+bool aes256gcm_available();
+
+// A per-direction session key bound to its cipher. For AES-256-GCM the key
+// schedule is expanded once here rather than on every packet. Nonces are
+// derived from the sequence exactly as in seal_packet/open_packet.
+class AeadKey {
+   public:
+    AeadKey(AeadCipher cipher, std::string_view key);
+
+    AeadCipher cipher() const { return m_cipher; }
+
+    size_t seal(std::span<char> buffer, size_t plaintext_len,
+                uint64_t sequence, std::string_view associated_data = {}) const;
+
+    bool open(std::span<char> buffer, uint64_t sequence, size_t* plaintext_len,
+              std::string_view associated_data = {}) const;
+
+   private:
+    struct AesGcmState;
+
+    AeadCipher m_cipher;
+    std::array<char, 32> m_key{};
+    std::shared_ptr<const AesGcmState> m_aes_state;
+};
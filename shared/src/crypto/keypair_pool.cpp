@@ -0,0 +1,94 @@
+#include "crypto/keypair_pool.hpp"
+
+#include <bit>
+
+#include "utils/check.hpp"
+
+EphemeralKeyPool::EphemeralKeyPool(size_t capacity)
+    : m_capacity(std::bit_ceil(capacity < 2 ? size_t{2} : capacity)),
+      m_cells(std::make_unique<Cell[]>(m_capacity)) {
+    for (size_t i = 0; i < m_capacity; ++i) {
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    m_refill_thread = std::thread([this] { refill_loop(); });
+}
+
+EphemeralKeyPool::~EphemeralKeyPool() {
+    m_stopping.store(true);
+    m_pops.fetch_add(1);
+    m_pops.notify_all();
+    m_refill_thread.join();
+}
+
+EphemeralKeyPair EphemeralKeyPool::take() {
+    EphemeralKeyPair key_pair;
+    const bool pooled = try_pop(&key_pair);
+    m_pops.fetch_add(1, std::memory_order_release);
+    m_pops.notify_one();
+    return pooled ? std::move(key_pair) : generate_ephemeral_keypair();
+}
+
+size_t EphemeralKeyPool::available() const {
+    const size_t enqueued = m_enqueue_pos.load(std::memory_order_relaxed);
+    const size_t dequeued = m_dequeue_pos.load(std::memory_order_relaxed);
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+}
+
+bool EphemeralKeyPool::try_push(EphemeralKeyPair&& key_pair) {
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+        Cell& cell = m_cells[pos & (m_capacity - 1)];
+        const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        const auto diff =
+            static_cast<std::ptrdiff_t>(sequence) -
+            static_cast<std::ptrdiff_t>(pos);
+        if (diff == 0) {
+            if (m_enqueue_pos.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed)) {
+                cell.key_pair = std::move(key_pair);
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;  // Full
+        } else {
+            pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool EphemeralKeyPool::try_pop(EphemeralKeyPair* key_pair) {
+    size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+        Cell& cell = m_cells[pos & (m_capacity - 1)];
+        const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        const auto diff =
+            static_cast<std::ptrdiff_t>(sequence) -
+            static_cast<std::ptrdiff_t>(pos + 1);
+        if (diff == 0) {
+            if (m_dequeue_pos.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed)) {
+                *key_pair = std::move(cell.key_pair);
+                cell.sequence.store(pos + m_capacity,
+                                    std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;  // Empty
+        } else {
+            pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void EphemeralKeyPool::refill_loop() {
+    while (!m_stopping.load()) {
+        // Snapshot before filling so a pop that races with the last push
+        // still wakes us up.
+        const uint32_t pops = m_pops.load(std::memory_order_acquire);
+        while (!m_stopping.load() && available() < m_capacity) {
+            if (!try_push(generate_ephemeral_keypair())) break;
+        }
+        m_pops.wait(pops, std::memory_order_acquire);
+    }
+}
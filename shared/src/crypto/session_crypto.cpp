@@ -1,5 +1,16 @@
 #include "crypto/session_crypto.hpp"
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
 #include "sodium.h"
 #include "utils/check.hpp"
 
@@ -10,6 +21,56 @@ void ensure_libsodium_initialized() {
         throw std::runtime_error("libsodium initialization failed");
     }
 }
+
+static_assert(AEAD_TAG_BYTES == crypto_aead_xchacha20poly1305_ietf_ABYTES);
+
+using SequenceNonce =
+    std::array<unsigned char, crypto_aead_xchacha20poly1305_ietf_NPUBBYTES>;
+
+using AesGcmNonce = std::array<unsigned char, crypto_aead_aes256gcm_NPUBBYTES>;
+
+static_assert(AEAD_TAG_BYTES == crypto_aead_aes256gcm_ABYTES);
+static_assert(crypto_aead_aes256gcm_KEYBYTES ==
+              crypto_aead_xchacha20poly1305_ietf_KEYBYTES);
+
+// Little-endian sequence number in the low bytes, zero padded.
+template <typename Nonce>
+Nonce nonce_from_sequence(uint64_t sequence) {
+    Nonce nonce{};
+    for (size_t i = 0; i < sizeof(sequence); ++i) {
+        nonce[i] = static_cast<unsigned char>(sequence >> (8 * i));
+    }
+    return nonce;
+}
+
+const unsigned char* as_uchar(const char* data) {
+    return reinterpret_cast<const unsigned char*>(data);
+}
+
+unsigned char* as_uchar(char* data) {
+    return reinterpret_cast<unsigned char*>(data);
+}
+
+// Writes `data` to a new file at `path` that only the owner can read; false
+// if `path` exists or cannot be written.
+bool write_private_file(const std::string& path, const std::string& data) {
+    const int fd = ::open(path.c_str(),
+                          O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+                          0600);
+    if (fd < 0) return false;
+    size_t written = 0;
+    while (written < data.size()) {
+        const ssize_t n =
+            ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        written += static_cast<size_t>(n);
+    }
+    const bool ok = written == data.size() && ::fsync(fd) == 0;
+    ::close(fd);
+    if (!ok) ::unlink(path.c_str());
+    return ok;
+}
 }  // namespace
 
 IdentityKeyPair generate_identity_keypair() {
@@ -26,6 +87,47 @@ IdentityKeyPair generate_identity_keypair() {
     return IdentityKeyPair{public_key, private_key};
 }
 
+IdentityKeyPair load_or_create_identity(const std::string& path) {
+    ensure_libsodium_initialized();
+    namespace fs = std::filesystem;
+
+    // The Ed25519 secret key embeds its public half, so only it is stored
+    if (std::ifstream in{path, std::ios::binary}) {
+        std::string private_key((std::istreambuf_iterator<char>(in)),
+                                std::istreambuf_iterator<char>());
+        if (private_key.size() != crypto_sign_SECRETKEYBYTES) {
+            throw std::runtime_error("Corrupt identity key file: " + path);
+        }
+        std::string public_key(crypto_sign_PUBLICKEYBYTES, '\0');
+        crypto_sign_ed25519_sk_to_pk(as_uchar(public_key.data()),
+                                     as_uchar(private_key.data()));
+        return IdentityKeyPair{public_key, private_key};
+    }
+
+    IdentityKeyPair identity = generate_identity_keypair();
+    const fs::path key_path(path);
+    if (key_path.has_parent_path() && !fs::exists(key_path.parent_path())) {
+        fs::create_directories(key_path.parent_path());
+        fs::permissions(key_path.parent_path(), fs::perms::owner_all);
+    }
+    // The key is written in full to a file that is owner-only from the
+    // start, then linked into place. link() never replaces a key another
+    // first run got there with, so both end up using that one.
+    const std::string temp_path = path + ".tmp." + std::to_string(::getpid());
+    ::unlink(temp_path.c_str());  // Left behind by a crash
+    if (!write_private_file(temp_path, identity.private_key)) {
+        throw std::runtime_error("Failed to write identity key file: " + path);
+    }
+    const bool linked = ::link(temp_path.c_str(), path.c_str()) == 0;
+    const int link_error = errno;
+    ::unlink(temp_path.c_str());
+    if (!linked) {
+        if (link_error == EEXIST) return load_or_create_identity(path);
+        throw std::runtime_error("Failed to write identity key file: " + path);
+    }
+    return identity;
+}
+
 EphemeralKeyPair generate_ephemeral_keypair() {
     ensure_libsodium_initialized();
     std::string public_key(crypto_kx_PUBLICKEYBYTES, '\0');
@@ -122,32 +224,80 @@ SessionKeys derive_server_keys(const EphemeralKeyPair& server_key_pair,
     return SessionKeys{tx, rx};
 }
 
+namespace {
+
+// Keyed BLAKE2b over label || input, 32 bytes out.
+std::string keyed_hash(std::string_view key, std::string_view label,
+                       std::string_view input) {
+    std::string message;
+    message.reserve(label.size() + input.size());
+    message.append(label).append(input);
+    std::string out(crypto_generichash_BYTES, '\0');
+    if (crypto_generichash(as_uchar(out.data()), out.size(),
+                           as_uchar(message.data()), message.size(),
+                           key.empty() ? nullptr : as_uchar(key.data()),
+                           key.size())) {
+        throw std::runtime_error("Key derivation failed");
+    }
+    return out;
+}
+
+}  // namespace
+
+std::string derive_resumption_secret(const SessionKeys& keys, bool is_client) {
+    ensure_libsodium_initialized();
+    CHECK(keys.tx_key.size() == crypto_kx_SESSIONKEYBYTES);
+    CHECK(keys.rx_key.size() == crypto_kx_SESSIONKEYBYTES);
+    // Both ends must hash the keys in the same order: receiver-to-sender
+    // first.
+    const std::string& to_sender = is_client ? keys.tx_key : keys.rx_key;
+    const std::string& to_receiver = is_client ? keys.rx_key : keys.tx_key;
+    return keyed_hash({}, "zapshare resumption", to_sender + to_receiver);
+}
+
+SessionKeys derive_resumption_keys(const std::string& resumption_secret,
+                                   const std::string& receiver_nonce,
+                                   bool is_client) {
+    ensure_libsodium_initialized();
+    if (resumption_secret.size() != crypto_generichash_KEYBYTES) {
+        throw std::runtime_error("Invalid resumption secret size");
+    }
+    if (receiver_nonce.empty()) {
+        throw std::runtime_error("Missing resumption nonce");
+    }
+    std::string to_sender =
+        keyed_hash(resumption_secret, "to_sender", receiver_nonce);
+    std::string to_receiver =
+        keyed_hash(resumption_secret, "to_receiver", receiver_nonce);
+    if (is_client) return SessionKeys{to_sender, to_receiver};
+    return SessionKeys{to_receiver, to_sender};
+}
+
 std::string encrypt_packet(const std::string& plaintext, const std::string& key,
                            uint64_t sequence) {
     ensure_libsodium_initialized();
     CHECK(key.size() == crypto_aead_xchacha20poly1305_ietf_KEYBYTES);
-    std::string nonce(crypto_aead_xchacha20poly1305_ietf_NPUBBYTES, '\0');
-    randombytes_buf(nonce.data(), nonce.size());
 
-    std::string associated_data(reinterpret_cast<const char*>(&sequence),
-                                sizeof(sequence));
-    std::string ciphertext(
-        plaintext.size() + crypto_aead_xchacha20poly1305_ietf_ABYTES, '\0');
+    // Wire layout: nonce || ciphertext || tag, built in a single buffer.
+    std::string packet(crypto_aead_xchacha20poly1305_ietf_NPUBBYTES +
+                           plaintext.size() +
+                           crypto_aead_xchacha20poly1305_ietf_ABYTES,
+                       '\0');
+    unsigned char* nonce = as_uchar(packet.data());
+    unsigned char* ciphertext =
+        nonce + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
+    randombytes_buf(nonce, crypto_aead_xchacha20poly1305_ietf_NPUBBYTES);
 
     unsigned long long ciphertext_len = 0;
     if (crypto_aead_xchacha20poly1305_ietf_encrypt(
-            reinterpret_cast<unsigned char*>(ciphertext.data()),
-            &ciphertext_len,
-            reinterpret_cast<const unsigned char*>(plaintext.data()),
-            plaintext.size(),
-            reinterpret_cast<const unsigned char*>(associated_data.data()),
-            associated_data.size(), nullptr,
-            reinterpret_cast<const unsigned char*>(nonce.data()),
-            reinterpret_cast<const unsigned char*>(key.data()))) {
+            ciphertext, &ciphertext_len, as_uchar(plaintext.data()),
+            plaintext.size(), reinterpret_cast<const unsigned char*>(&sequence),
+            sizeof(sequence), nullptr, nonce, as_uchar(key.data()))) {
         throw std::runtime_error("Packet encryption failed");
     }
-    ciphertext.resize(ciphertext_len);
-    return nonce + ciphertext;
+    packet.resize(crypto_aead_xchacha20poly1305_ietf_NPUBBYTES +
+                  ciphertext_len);
+    return packet;
 }
 
 bool decrypt_packet(const std::string& ciphertext, const std::string& key,
@@ -159,37 +309,137 @@ bool decrypt_packet(const std::string& ciphertext, const std::string& key,
                                 crypto_aead_xchacha20poly1305_ietf_ABYTES) {
         return false;
     }
-    std::string nonce =
-        ciphertext.substr(0, crypto_aead_xchacha20poly1305_ietf_NPUBBYTES);
-
-    std::string encrypted_payload =
-        ciphertext.substr(crypto_aead_xchacha20poly1305_ietf_NPUBBYTES);
-
-    if (encrypted_payload.size() < crypto_aead_xchacha20poly1305_ietf_ABYTES) {
-        return false;
-    }
-
-    std::string associated_data(reinterpret_cast<const char*>(&sequence),
-                                sizeof(sequence));
+    const unsigned char* nonce = as_uchar(ciphertext.data());
+    const unsigned char* encrypted_payload =
+        nonce + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
+    const size_t encrypted_len =
+        ciphertext.size() - crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
 
     std::string decrypted_payload(
-        encrypted_payload.size() - crypto_aead_xchacha20poly1305_ietf_ABYTES,
-        '\0');
+        encrypted_len - crypto_aead_xchacha20poly1305_ietf_ABYTES, '\0');
 
     unsigned long long decrypted_len = 0;
 
     if (crypto_aead_xchacha20poly1305_ietf_decrypt(
-            reinterpret_cast<unsigned char*>(decrypted_payload.data()),
-            &decrypted_len, nullptr,
-            reinterpret_cast<const unsigned char*>(encrypted_payload.data()),
-            encrypted_payload.size(),
-            reinterpret_cast<const unsigned char*>(associated_data.data()),
-            associated_data.size(),
-            reinterpret_cast<const unsigned char*>(nonce.data()),
-            reinterpret_cast<const unsigned char*>(key.data()))) {
+            as_uchar(decrypted_payload.data()), &decrypted_len, nullptr,
+            encrypted_payload, encrypted_len,
+            reinterpret_cast<const unsigned char*>(&sequence), sizeof(sequence),
+            nonce, as_uchar(key.data()))) {
         return false;
     }
     decrypted_payload.resize(decrypted_len);
     *plaintext = std::move(decrypted_payload);
     return true;
-}
\ No newline at end of file
+}
+
+size_t seal_packet(std::span<char> buffer, size_t plaintext_len,
+                   std::string_view key, uint64_t sequence,
+                   std::string_view associated_data) {
+    ensure_libsodium_initialized();
+    CHECK(key.size() == crypto_aead_xchacha20poly1305_ietf_KEYBYTES);
+    CHECK(buffer.size() >= plaintext_len + AEAD_TAG_BYTES);
+
+    const auto nonce = nonce_from_sequence<SequenceNonce>(sequence);
+    unsigned char* data = as_uchar(buffer.data());
+    if (crypto_aead_xchacha20poly1305_ietf_encrypt_detached(
+            data, data + plaintext_len, nullptr, data, plaintext_len,
+            as_uchar(associated_data.data()), associated_data.size(), nullptr,
+            nonce.data(), as_uchar(key.data()))) {
+        throw std::runtime_error("Packet encryption failed");
+    }
+    return plaintext_len + AEAD_TAG_BYTES;
+}
+
+bool open_packet(std::span<char> buffer, std::string_view key,
+                 uint64_t sequence, size_t* plaintext_len,
+                 std::string_view associated_data) {
+    ensure_libsodium_initialized();
+    CHECK(plaintext_len != nullptr);
+    CHECK(key.size() == crypto_aead_xchacha20poly1305_ietf_KEYBYTES);
+    if (buffer.size() < AEAD_TAG_BYTES) {
+        return false;
+    }
+
+    const auto nonce = nonce_from_sequence<SequenceNonce>(sequence);
+    const size_t ciphertext_len = buffer.size() - AEAD_TAG_BYTES;
+    unsigned char* data = as_uchar(buffer.data());
+    if (crypto_aead_xchacha20poly1305_ietf_decrypt_detached(
+            data, nullptr, data, ciphertext_len, data + ciphertext_len,
+            as_uchar(associated_data.data()), associated_data.size(),
+            nonce.data(), as_uchar(key.data()))) {
+        return false;
+    }
+    *plaintext_len = ciphertext_len;
+    return true;
+}
+
+bool aes256gcm_available() {
+    ensure_libsodium_initialized();
+    return crypto_aead_aes256gcm_is_available() == 1;
+}
+
+struct AeadKey::AesGcmState {
+    crypto_aead_aes256gcm_state state;
+};
+
+AeadKey::AeadKey(AeadCipher cipher, std::string_view key) : m_cipher(cipher) {
+    ensure_libsodium_initialized();
+    CHECK(key.size() == m_key.size());
+    std::copy(key.begin(), key.end(), m_key.begin());
+    if (m_cipher == AeadCipher::Aes256Gcm) {
+        if (!aes256gcm_available()) {
+            throw std::runtime_error("AES-256-GCM is not available");
+        }
+        auto aes_state = std::make_shared<AesGcmState>();
+        crypto_aead_aes256gcm_beforenm(&aes_state->state,
+                                       as_uchar(m_key.data()));
+        m_aes_state = std::move(aes_state);
+    }
+}
+
+size_t AeadKey::seal(std::span<char> buffer, size_t plaintext_len,
+                     uint64_t sequence,
+                     std::string_view associated_data) const {
+    if (m_cipher == AeadCipher::XChaCha20Poly1305) {
+        return seal_packet(buffer, plaintext_len,
+                           std::string_view(m_key.data(), m_key.size()),
+                           sequence, associated_data);
+    }
+    CHECK(buffer.size() >= plaintext_len + AEAD_TAG_BYTES);
+
+    const auto nonce = nonce_from_sequence<AesGcmNonce>(sequence);
+    unsigned char* data = as_uchar(buffer.data());
+    if (crypto_aead_aes256gcm_encrypt_detached_afternm(
+            data, data + plaintext_len, nullptr, data, plaintext_len,
+            as_uchar(associated_data.data()), associated_data.size(), nullptr,
+            nonce.data(), &m_aes_state->state)) {
+        throw std::runtime_error("Packet encryption failed");
+    }
+    return plaintext_len + AEAD_TAG_BYTES;
+}
+
+bool AeadKey::open(std::span<char> buffer, uint64_t sequence,
+                   size_t* plaintext_len,
+                   std::string_view associated_data) const {
+    if (m_cipher == AeadCipher::XChaCha20Poly1305) {
+        return open_packet(buffer,
+                           std::string_view(m_key.data(), m_key.size()),
+                           sequence, plaintext_len, associated_data);
+    }
+    CHECK(plaintext_len != nullptr);
+    if (buffer.size() < AEAD_TAG_BYTES) {
+        return false;
+    }
+
+    const auto nonce = nonce_from_sequence<AesGcmNonce>(sequence);
+    const size_t ciphertext_len = buffer.size() - AEAD_TAG_BYTES;
+    unsigned char* data = as_uchar(buffer.data());
+    if (crypto_aead_aes256gcm_decrypt_detached_afternm(
+            data, nullptr, data, ciphertext_len, data + ciphertext_len,
+            as_uchar(associated_data.data()), associated_data.size(),
+            nonce.data(), &m_aes_state->state)) {
+        return false;
+    }
+    *plaintext_len = ciphertext_len;
+    return true;
+}
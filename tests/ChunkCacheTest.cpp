@@ -0,0 +1,127 @@
+#include <unistd.h>
+
+#include <asio.hpp>
+#include <cassert>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "chunk_cache.hpp"
+#include "source_file.hpp"
+
+namespace fs = std::filesystem;
+
+constexpr size_t BLOCK = ChunkCache::BLOCK_SIZE;
+// Seven and a half blocks, so the last one is short
+constexpr uint64_t FILE_SIZE = 7 * BLOCK + BLOCK / 2;
+constexpr uint64_t BLOCKS = (FILE_SIZE + BLOCK - 1) / BLOCK;
+
+const fs::path PATH = fs::temp_directory_path() /
+                      ("zapshare_chunk_cache_test_" +
+                       std::to_string(::getpid()));
+
+char expected_byte(uint64_t offset) {
+    return static_cast<char>(offset * 31 + offset / BLOCK);
+}
+
+void write_file() {
+    std::vector<char> data(FILE_SIZE);
+    for (uint64_t i = 0; i < FILE_SIZE; ++i) data[i] = expected_byte(i);
+    std::ofstream(PATH, std::ios::binary)
+        .write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+// Runs the posted waiters; the guard keeps run_one() waiting for them
+asio::io_context io;
+auto work = asio::make_work_guard(io);
+
+// Reads one whole block, waiting for the read-ahead when it is pending,
+// and checks what came back
+void read_block(ChunkCache& cache, ChunkCache::ReaderId reader,
+                uint64_t block) {
+    const uint64_t offset = block * BLOCK;
+    std::vector<char> buffer(BLOCK);
+    ssize_t n;
+    while ((n = cache.read(reader, offset, buffer.data(), buffer.size())) ==
+           ChunkCache::PENDING) {
+        bool ready = false;
+        cache.when_ready(offset, io.get_executor(), [&] { ready = true; });
+        while (!ready) io.run_one();
+    }
+    assert(n == static_cast<ssize_t>(std::min<uint64_t>(
+                    BLOCK, FILE_SIZE - offset)));
+    for (ssize_t i = 0; i < n; ++i) {
+        assert(buffer[i] == expected_byte(offset + i));
+    }
+}
+
+void test_each_block_loaded_once() {
+    ChunkCache cache(SourceFile::open(PATH.string()), 4, 2);
+    std::vector<ChunkCache::ReaderId> readers;
+    for (int i = 0; i < 3; ++i) readers.push_back(cache.attach());
+    for (uint64_t block = 0; block < BLOCKS; ++block) {
+        for (ChunkCache::ReaderId reader : readers) {
+            read_block(cache, reader, block);
+        }
+    }
+    const ChunkCache::Stats stats = cache.stats();
+    assert(stats.blocks_loaded == BLOCKS);
+    assert(stats.direct_reads == 0);
+}
+
+void test_late_reader_goes_direct() {
+    ChunkCache cache(SourceFile::open(PATH.string()), 2, 1);
+    const ChunkCache::ReaderId leader = cache.attach();
+    for (uint64_t block = 0; block < 5; ++block) {
+        read_block(cache, leader, block);
+    }
+    // Block 0 is long gone and will not be loaded again
+    const ChunkCache::ReaderId late = cache.attach();
+    read_block(cache, late, 0);
+    read_block(cache, late, 1);
+    assert(cache.stats().direct_reads == 2);
+
+    // The late reader no longer holds the leader back
+    for (uint64_t block = 5; block < BLOCKS; ++block) {
+        read_block(cache, leader, block);
+    }
+    assert(cache.stats().blocks_loaded == BLOCKS);
+}
+
+void test_stalled_reader_released() {
+    ChunkCache cache(SourceFile::open(PATH.string()), 2, 1);
+    const ChunkCache::ReaderId stalled = cache.attach();
+    const ChunkCache::ReaderId leader = cache.attach();
+    read_block(cache, stalled, 0);
+
+    // Block 2 needs block 0's room, which the stalled reader pins
+    const auto start = std::chrono::steady_clock::now();
+    for (uint64_t block = 0; block < BLOCKS; ++block) {
+        read_block(cache, leader, block);
+    }
+    assert(std::chrono::steady_clock::now() - start >=
+           ChunkCache::MAX_THROTTLE);
+    ChunkCache::Stats stats = cache.stats();
+    assert(stats.throttle_waits >= 1);
+    assert(stats.blocks_loaded == BLOCKS);
+    assert(stats.direct_reads == 0);
+
+    // Released, it reads the file itself
+    read_block(cache, stalled, 1);
+    stats = cache.stats();
+    assert(stats.direct_reads == 1);
+    assert(stats.blocks_loaded == BLOCKS);
+}
+
+int main() {
+    write_file();
+    test_each_block_loaded_once();
+    test_late_reader_goes_direct();
+    test_stalled_reader_released();
+    fs::remove(PATH);
+    std::cout << "Chunk cache tests passed\n";
+    return 0;
+}
@@ -1,7 +1,14 @@
+#include <array>
 #include <cassert>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
+#include <iterator>
+#include <set>
 #include <string>
 
+#include "crypto/keypair_pool.hpp"
+#include "crypto/replay_window.hpp"
 #include "crypto/session_crypto.hpp"
 
 void test() {
@@ -40,8 +47,151 @@ void test() {
                            &wrong_sequence_plaintext));
 }
 
+void test_in_place() {
+    EphemeralKeyPair client_keys = generate_ephemeral_keypair();
+    EphemeralKeyPair server_keys = generate_ephemeral_keypair();
+    SessionKeys client_session =
+        derive_client_keys(client_keys, server_keys.public_key);
+    SessionKeys server_session =
+        derive_server_keys(server_keys, client_keys.public_key);
+
+    const std::string plaintext = "in place packet";
+    const std::string header = "transfer-id";
+    std::array<char, 64> buffer{};
+    std::memcpy(buffer.data(), plaintext.data(), plaintext.size());
+
+    size_t sealed_len = seal_packet(buffer, plaintext.size(),
+                                    client_session.tx_key, 7, header);
+    assert(sealed_len == plaintext.size() + AEAD_TAG_BYTES);
+    assert(std::memcmp(buffer.data(), plaintext.data(), plaintext.size()));
+
+    // Wrong sequence, associated data or tampering must all be rejected
+    std::array<char, 64> copy = buffer;
+    size_t opened_len = 0;
+    assert(!open_packet(std::span(copy).first(sealed_len),
+                        server_session.rx_key, 8, &opened_len, header));
+    assert(!open_packet(std::span(copy).first(sealed_len),
+                        server_session.rx_key, 7, &opened_len, "other"));
+    copy[0] ^= 1;
+    assert(!open_packet(std::span(copy).first(sealed_len),
+                        server_session.rx_key, 7, &opened_len, header));
+
+    assert(open_packet(std::span(buffer).first(sealed_len),
+                       server_session.rx_key, 7, &opened_len, header));
+    assert(opened_len == plaintext.size());
+    assert(std::string(buffer.data(), opened_len) == plaintext);
+}
+
+void test_replay_window() {
+    ReplayWindow window;
+    assert(window.can_accept(5));
+    window.accept(5);
+    assert(!window.can_accept(5));
+
+    // Reordered packets inside the window are accepted exactly once
+    assert(window.can_accept(3));
+    window.accept(3);
+    assert(!window.can_accept(3));
+    assert(window.can_accept(4));
+
+    window.accept(5 + ReplayWindow::WINDOW_SIZE);
+    assert(!window.can_accept(5));
+    assert(!window.can_accept(4));
+    assert(window.can_accept(6));
+}
+
+void test_aead_key(AeadCipher cipher) {
+    EphemeralKeyPair client_keys = generate_ephemeral_keypair();
+    EphemeralKeyPair server_keys = generate_ephemeral_keypair();
+    AeadKey sealer(cipher, derive_client_keys(client_keys,
+                                              server_keys.public_key)
+                               .tx_key);
+    AeadKey opener(cipher, derive_server_keys(server_keys,
+                                              client_keys.public_key)
+                               .rx_key);
+
+    const std::string plaintext = "cipher suite packet";
+    std::array<char, 64> buffer{};
+    std::memcpy(buffer.data(), plaintext.data(), plaintext.size());
+    size_t sealed_len = sealer.seal(buffer, plaintext.size(), 42, "ad");
+
+    size_t opened_len = 0;
+    std::array<char, 64> copy = buffer;
+    assert(!opener.open(std::span(copy).first(sealed_len), 41, &opened_len,
+                        "ad"));
+    assert(opener.open(std::span(buffer).first(sealed_len), 42, &opened_len,
+                       "ad"));
+    assert(std::string(buffer.data(), opened_len) == plaintext);
+}
+
+void test_keypair_pool() {
+    EphemeralKeyPool pool(4);
+    std::set<std::string> seen;
+    // Drains past capacity, so some pairs come from the inline fallback
+    for (int i = 0; i < 16; ++i) {
+        EphemeralKeyPair key_pair = pool.take();
+        assert(key_pair.public_key.size() == 32);
+        assert(key_pair.private_key.size() == 32);
+        assert(seen.insert(key_pair.public_key).second);
+    }
+}
+
+void test_persisted_identity() {
+    const auto path = std::filesystem::temp_directory_path() /
+                      "zapshare_crypto_test" / "identity.key";
+    std::filesystem::remove_all(path.parent_path());
+
+    IdentityKeyPair created = load_or_create_identity(path.string());
+    IdentityKeyPair loaded = load_or_create_identity(path.string());
+    // Only the owner can get at the key or the directory holding it
+    namespace fs = std::filesystem;
+    assert(fs::status(path).permissions() ==
+           (fs::perms::owner_read | fs::perms::owner_write));
+    assert(fs::status(path.parent_path()).permissions() ==
+           fs::perms::owner_all);
+    assert(std::distance(fs::directory_iterator(path.parent_path()),
+                         fs::directory_iterator()) == 1);
+    assert(created.public_key == loaded.public_key);
+    assert(created.private_key == loaded.private_key);
+
+    std::string signature = sign("persisted", loaded);
+    assert(verify_signature("persisted", signature, created.public_key));
+    std::filesystem::remove_all(path.parent_path());
+}
+
+void test_resumption_keys() {
+    EphemeralKeyPair client_keys = generate_ephemeral_keypair();
+    EphemeralKeyPair server_keys = generate_ephemeral_keypair();
+    const std::string client_secret = derive_resumption_secret(
+        derive_client_keys(client_keys, server_keys.public_key), true);
+    const std::string server_secret = derive_resumption_secret(
+        derive_server_keys(server_keys, client_keys.public_key), false);
+    assert(client_secret == server_secret);
+
+    const std::string nonce = random_nonce(32);
+    SessionKeys client = derive_resumption_keys(client_secret, nonce, true);
+    SessionKeys server = derive_resumption_keys(server_secret, nonce, false);
+    assert(client.tx_key == server.rx_key);
+    assert(client.rx_key == server.tx_key);
+    assert(client.tx_key != client.rx_key);
+
+    // A fresh nonce must give fresh keys
+    SessionKeys again =
+        derive_resumption_keys(client_secret, random_nonce(32), true);
+    assert(again.tx_key != client.tx_key);
+}
+
 int main() {
     test();
+    test_in_place();
+    test_replay_window();
+    test_aead_key(AeadCipher::XChaCha20Poly1305);
+    if (aes256gcm_available()) {
+        test_aead_key(AeadCipher::Aes256Gcm);
+    }
+    test_keypair_pool();
+    test_persisted_identity();
+    test_resumption_keys();
     std::cout << "Crypto tests passed\n";
     return 0;
 }
\ No newline at end of file
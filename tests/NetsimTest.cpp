@@ -0,0 +1,176 @@
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include "netsim.hpp"
+
+using namespace std::chrono_literals;
+
+using Netsim::Clock;
+using Netsim::Fate;
+using Netsim::Impairment;
+using Netsim::Link;
+
+// Offers `count` packets a millisecond apart
+std::vector<Fate> run(const Impairment& impairment, int count,
+                      size_t bytes = 1400) {
+    Link link(impairment);
+    std::vector<Fate> fates;
+    Clock::time_point now{};
+    for (int i = 0; i < count; ++i, now += 1ms) {
+        fates.push_back(link.transmit(now, bytes));
+    }
+    return fates;
+}
+
+void test_parse() {
+    const Impairment impairment = Impairment::parse(
+        "delay=50ms,jitter=500us,loss=2%,burst=4,reorder=0.01,"
+        "duplicate=1%,rate=20mbit,queue=64k,seed=7");
+    assert(impairment.delay == 50ms);
+    assert(impairment.jitter == 500us);
+    assert(std::abs(impairment.loss - 0.02) < 1e-12);
+    assert(impairment.burst == 4);
+    assert(std::abs(impairment.reorder - 0.01) < 1e-12);
+    assert(impairment.rate == 20'000'000);
+    assert(impairment.queue == 64 * 1024);
+    assert(impairment.seed == 7);
+
+    for (const char* bad : {"delay", "delay=fast", "loss=100%", "mtu=1500",
+                            "rate=5furlongs"}) {
+        bool threw = false;
+        try {
+            Impairment::parse(bad);
+        } catch (const std::invalid_argument&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+}
+
+void test_perfect_link() {
+    Clock::time_point sent{};
+    for (const Fate& fate : run(Impairment{}, 100)) {
+        assert(fate.copies == 1);
+        assert(fate.arrive_at[0] == sent);
+        sent += 1ms;
+    }
+}
+
+void test_delay_and_jitter() {
+    Impairment impairment;
+    impairment.delay = 50ms;
+    impairment.jitter = 5ms;
+    Clock::time_point sent{};
+    for (const Fate& fate : run(impairment, 1000)) {
+        const auto delay = fate.arrive_at[0] - sent;
+        assert(delay >= 45ms && delay <= 55ms);
+        sent += 1ms;
+    }
+}
+
+size_t count_lost(const std::vector<Fate>& fates) {
+    size_t lost = 0;
+    for (const Fate& fate : fates) lost += fate.copies == 0;
+    return lost;
+}
+
+void test_loss() {
+    Impairment impairment;
+    impairment.loss = 0.02;
+    const auto fates = run(impairment, 100'000);
+    const double rate = static_cast<double>(count_lost(fates)) / fates.size();
+    assert(rate > 0.015 && rate < 0.025);
+
+    // Same seed, same losses; another seed, others
+    const auto again = run(impairment, 100'000);
+    impairment.seed = 2;
+    const auto other = run(impairment, 100'000);
+    bool same = true;
+    bool differs = false;
+    for (size_t i = 0; i < fates.size(); ++i) {
+        same &= fates[i].copies == again[i].copies;
+        differs |= fates[i].copies != other[i].copies;
+    }
+    assert(same && differs);
+}
+
+void test_burst_loss() {
+    Impairment impairment;
+    impairment.loss = 0.02;
+    impairment.burst = 8;
+    const auto fates = run(impairment, 200'000);
+    const size_t lost = count_lost(fates);
+    size_t bursts = 0;
+    for (size_t i = 0; i < fates.size(); ++i) {
+        if (fates[i].copies == 0 && (i == 0 || fates[i - 1].copies != 0)) {
+            ++bursts;
+        }
+    }
+    const double rate = static_cast<double>(lost) / fates.size();
+    const double mean_burst = static_cast<double>(lost) / bursts;
+    assert(rate > 0.015 && rate < 0.025);
+    assert(mean_burst > 6 && mean_burst < 10);
+}
+
+void test_rate_cap() {
+    // 1400-byte packets every millisecond is 11.2 Mbit/s, offered to a
+    // 5.6 Mbit/s link: half get through once its queue has filled
+    Impairment impairment;
+    impairment.rate = 5'600'000;
+    impairment.queue = 14'000;
+    Link link(impairment);
+    Clock::time_point now{};
+    Clock::time_point last_arrival{};
+    size_t delivered = 0;
+    for (int i = 0; i < 10'000; ++i, now += 1ms) {
+        const Fate fate = link.transmit(now, 1400);
+        if (fate.copies == 0) continue;
+        ++delivered;
+        // Serialised: never sooner than 2 ms after the previous packet
+        assert(fate.arrive_at[0] - last_arrival >= 2ms || delivered == 1);
+        last_arrival = fate.arrive_at[0];
+        // Never waits behind more than a queue's worth of packets
+        assert(fate.arrive_at[0] - now <= 22ms);
+    }
+    assert(delivered > 4900 && delivered < 5100);
+    assert(link.counters().overflowed == 10'000 - delivered);
+}
+
+void test_reorder_and_duplicate() {
+    Impairment impairment;
+    impairment.reorder = 0.1;
+    impairment.reorder_gap = 5ms;
+    impairment.duplicate = 0.05;
+    Link link(impairment);
+    Clock::time_point now{};
+    size_t overtaken = 0;
+    size_t copies = 0;
+    Clock::time_point latest{};
+    for (int i = 0; i < 10'000; ++i, now += 1ms) {
+        const Fate fate = link.transmit(now, 1400);
+        copies += fate.copies;
+        if (fate.arrive_at[0] < latest) ++overtaken;
+        latest = std::max(latest, fate.arrive_at[0]);
+    }
+    assert(link.counters().reordered > 900 && link.counters().reordered < 1200);
+    assert(overtaken > 0);
+    assert(copies == 10'000 + link.counters().duplicated);
+    assert(link.counters().duplicated > 400 &&
+           link.counters().duplicated < 600);
+}
+
+int main() {
+    test_parse();
+    test_perfect_link();
+    test_delay_and_jitter();
+    test_loss();
+    test_burst_loss();
+    test_rate_cap();
+    test_reorder_and_duplicate();
+    std::cout << "Netsim tests passed\n";
+    return 0;
+}
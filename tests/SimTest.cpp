@@ -0,0 +1,98 @@
+#include <unistd.h>
+
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include "netsim.hpp"
+#include "sim_transfer.hpp"
+
+using namespace std::chrono_literals;
+
+namespace fs = std::filesystem;
+
+const fs::path DIR = fs::temp_directory_path() /
+                     ("zapshare_sim_test_" + std::to_string(::getpid()));
+
+std::string read_file(const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(in), {}};
+}
+
+fs::path write_source(size_t size) {
+    const fs::path path = DIR / "source";
+    std::mt19937 random(1);
+    std::string bytes(size, '\0');
+    for (char& byte : bytes) byte = static_cast<char>(random());
+    std::ofstream(path, std::ios::binary) << bytes;
+    return path;
+}
+
+Sim::TransferResult transfer(const fs::path& source, const std::string& spec) {
+    const fs::path output = DIR / "received";
+    fs::remove(output);
+    const Sim::TransferResult result = Sim::run_transfer(
+        source.string(), output.string(), Netsim::Impairment::parse(spec));
+    if (result.completed) assert(read_file(output) == read_file(source));
+    return result;
+}
+
+void test_clean_link(const fs::path& source) {
+    const Sim::TransferResult result = transfer(source, "delay=10ms");
+    assert(result.completed);
+    assert(result.up.lost == 0 && result.down.lost == 0);
+    // Stop-and-wait: a round trip per packet, plus the handshake's
+    const uint64_t packets =
+        (fs::file_size(source) + UdpConfig::PAYLOAD_SIZE - 1) /
+        UdpConfig::PAYLOAD_SIZE;
+    assert(result.elapsed >= packets * 20ms);
+    assert(result.elapsed < (packets + 10) * 20ms);
+}
+
+void test_lossy_link_is_deterministic(const fs::path& source) {
+    const std::string spec = "delay=50ms,jitter=5ms,loss=5%,seed=3";
+    const Sim::TransferResult first = transfer(source, spec);
+    const Sim::TransferResult second = transfer(source, spec);
+    assert(first.completed && second.completed);
+    assert(first.down.lost > 0 && first.up.lost > 0);
+    assert(first.elapsed == second.elapsed);
+    assert(first.up.offered == second.up.offered);
+    assert(first.down.offered == second.down.offered);
+    assert(first.down.lost == second.down.lost);
+
+    // Another seed loses other packets
+    const Sim::TransferResult other =
+        transfer(source, "delay=50ms,jitter=5ms,loss=5%,seed=4");
+    assert(other.completed);
+    assert(other.elapsed != first.elapsed);
+}
+
+void test_dead_link_gives_up(const fs::path& source) {
+    const Sim::TransferResult result = transfer(source, "loss=99%");
+    assert(!result.completed);
+}
+
+int main() {
+    fs::create_directories(DIR);
+    ::setenv("ZAPSHARE_IDENTITY", (DIR / "identity.key").c_str(), 1);
+    ::setenv("ZAPSHARE_TICKET_DIR", (DIR / "tickets").c_str(), 1);
+    ::setenv("ZAPSHARE_STATS", "off", 1);
+    // Both ends log every step
+    std::streambuf* out = std::cout.rdbuf(nullptr);
+
+    const fs::path source = write_source(64 * 1024);
+    test_clean_link(source);
+    test_lossy_link_is_deterministic(source);
+    test_dead_link_gives_up(source);
+
+    std::cout.rdbuf(out);
+    fs::remove_all(DIR);
+    std::cout << "Simulation tests passed\n";
+    return 0;
+}
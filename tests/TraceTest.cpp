@@ -0,0 +1,98 @@
+#include <unistd.h>
+
+#include <cassert>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "trace.hpp"
+
+namespace fs = std::filesystem;
+
+const fs::path PATH = fs::temp_directory_path() /
+                      ("zapshare_trace_test_" + std::to_string(::getpid()));
+
+std::vector<Trace::Record> read_records() {
+    std::ifstream in(PATH, std::ios::binary);
+    Trace::FileHeader header{};
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    assert(in && header.magic == Trace::MAGIC);
+    assert(header.version == Trace::VERSION);
+    assert(header.record_size == sizeof(Trace::Record));
+    std::vector<Trace::Record> records;
+    Trace::Record record{};
+    while (in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+        records.push_back(record);
+    }
+    return records;
+}
+
+void record_sent(uint64_t connection, uint64_t count) {
+    for (uint64_t i = 0; i < count; ++i) {
+        Trace::record(Trace::Event::PacketSent, Trace::Role::Sender,
+                      connection, i * 1272, 1272);
+    }
+}
+
+void test_off_by_default() {
+    assert(!Trace::enabled());
+    record_sent(1, 10);
+    assert(!fs::exists(PATH));
+}
+
+void test_records_every_thread() {
+    assert(Trace::start(PATH.string()));
+    assert(Trace::enabled());
+    // More than a ring's worth, so some go out before stop()
+    record_sent(1, Trace::RING_RECORDS + 10);
+    std::thread other([] { record_sent(2, 100); });
+    other.join();
+    // Left in another thread's ring until stop()
+    std::thread idle([] { record_sent(3, 5); });
+    idle.join();
+    Trace::stop();
+    assert(!Trace::enabled());
+    record_sent(1, 10);
+
+    const std::vector<Trace::Record> records = read_records();
+    assert(records.size() == Trace::RING_RECORDS + 115);
+    size_t per_connection[4] = {};
+    int64_t last = 0;
+    for (const Trace::Record& record : records) {
+        assert(record.event == Trace::Event::PacketSent);
+        assert(record.extra == 1272);
+        ++per_connection[record.connection];
+        if (record.connection == 1) {
+            // One thread's records stay in order
+            assert(record.time_ns >= last);
+            last = record.time_ns;
+        }
+    }
+    assert(per_connection[1] == Trace::RING_RECORDS + 10);
+    assert(per_connection[2] == 100);
+    assert(per_connection[3] == 5);
+}
+
+void test_restart_appends() {
+    assert(Trace::start(PATH.string()));
+    record_sent(4, 3);
+    Trace::stop();
+    // One header, then the earlier records and these
+    assert(read_records().size() == Trace::RING_RECORDS + 118);
+
+    assert(!Trace::start((PATH / "no" / "such" / "dir").string()));
+    assert(!Trace::enabled());
+}
+
+int main() {
+    fs::remove(PATH);
+    test_off_by_default();
+    test_records_every_thread();
+    test_restart_appends();
+    fs::remove(PATH);
+    std::cout << "Trace tests passed\n";
+    return 0;
+}